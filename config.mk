@@ -2,13 +2,20 @@
 # User and Platform Specific Configuration Options
 #------------------------------------------------------------------------------
 # Override the tools used with platform specific ones
-#CC = cc
-#LD = ${CC}
+#CC  = cc
+#CXX = c++
+#LD  = ${CXX}
 #AR = ar
 
 # GCC dependency generation
 #COMPILE += && ${CC} ${INCS} -MM -MT $@ -MF ${@:.o=.d} ${<:.o=.c}
 
+# Collect parser and query metrics, see opts_metrics()
+#CPPFLAGS += -DOPTS_METRICS
+
+# Fail benchmarks that run slower than the results recorded by 'make baseline'
+#BENCH_BASELINE = bench.baseline
+
 # Enable output of debug symbols
 #CFLAGS += -g
 
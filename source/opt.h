@@ -19,6 +19,9 @@
  *     } OPTEND;
  *     return 0;
  * }
+ *
+ * OPTBEGIN_GNU can be used in place of OPTBEGIN to accept options anywhere on
+ * the command line rather than only before the first positional argument.
  */
 #ifndef OPT_H
 #define OPT_H
@@ -47,6 +50,29 @@ static inline char* getopt(int* p_argc, char*** p_argv) {
     }
 }
 
+/* This is a helper function used by OPTBEGIN_GNU to find the next option.
+ * Positional arguments are moved down to dst as they are passed over, which
+ * only ever overwrites elements that have already been read. Once there are
+ * no options left, argv and argc are set to the positional arguments, which
+ * end with a NULL, and 0 is returned.
+ */
+static inline int nextopt(int* p_argc, char*** p_argv, char** start, char*** p_dst) {
+    char** argv = *p_argv;
+    while (argv[0] && !(argv[0][0] == '-' && argv[0][1]))
+        *(*p_dst)++ = *argv++;
+    if (argv[0] && !(argv[0][1] == '-' && !argv[0][2])) {
+        *p_argv = argv;
+        return 1;
+    }
+    /* Everything after a -- is a positional argument */
+    for (argv += (argv[0] != 0); argv[0]; argv++)
+        *(*p_dst)++ = *argv;
+    **p_dst = (char*)0;
+    *p_argc = (int)(*p_dst - start);
+    *p_argv = start;
+    return 0;
+}
+
 /* This macro is almost identical to the ARGBEGIN macro from suckless.org. If
  * it ain't broke, don't fix it. */
 #define OPTBEGIN                                                              \
@@ -64,6 +90,23 @@ static inline char* getopt(int* p_argc, char*** p_argv) {
             argc_ = argv[0][0];                                               \
             switch (argc_)
 
+/* This macro works like OPTBEGIN but permutes the command line the way GNU
+ * getopt does, so that "prog file -v" sets -v. Options are parsed in the
+ * order they appear until a --. Afterwards argv and argc hold the positional
+ * arguments in their original order, compacted in place at the front of argv
+ * in a single pass without allocating. */
+#define OPTBEGIN_GNU                                                          \
+    for (                                                                     \
+        char **optpos_ = (ARGV0 = *argv, argc--, ++argv), **optdst_ = optpos_;\
+        nextopt(&argc, &argv, optpos_, &optdst_);                             \
+        argc--, argv++                                                        \
+    ) {                                                                       \
+        int brk_; char argc_ , **argv_, *optarg_;                             \
+        for (brk_=0, argv[0]++, argv_=argv; argv[0][0] && !brk_; argv[0]++) { \
+            if (argv_ != argv) break;                                         \
+            argc_ = argv[0][0];                                               \
+            switch (argc_)
+
 /* Terminate the option parsing. */
 #define OPTEND }}
 
@@ -1,336 +1,2172 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef OPTS_METRICS
+#include <time.h>
+#endif
 #include "opts.h"
 
 /* Type and Function Declarations
  *****************************************************************************/
 typedef struct {
-    char* name;
-    char* tag;
-    char* value;
-} option_t;
+    uint32_t seed;
+    size_t mask;
+    uint16_t* slots;
+} perfect_t;
 
-typedef struct entry_t {
-    void* value;
-    struct entry_t* next;
-} entry_t;
-
-typedef enum { LONG, SHORT } opt_type_t;
+/* A relationship rule compiled to the set of options it applies to. Rules of
+ * the whole table have no holder. */
+typedef struct {
+    uint16_t holder;
+    uint16_t kind;
+    const opts_rule_t* decl;
+} rule_t;
 
 typedef struct {
-    unsigned int line_idx;
-    unsigned int col_idx;
-    unsigned int arg_count;
-    char** arg_vect;
-    int current;
     opts_cfg_t* options;
+    size_t count;
+    size_t* lengths;
+    uint16_t* tags;
+    size_t mask;
+    uint16_t* names;
+    uint16_t* tag_names;
+    uint16_t shorts[256];
+    perfect_t* enums;
+    uint16_t* flag_bits;
+    uint16_t* logical;
+    size_t num_flags;
+    bool constrained;
+    size_t num_rules;
+    rule_t* rules;
+    uint64_t* rule_masks;
+} schema_t;
+
+/* A memoized selection, chained into one of a fixed set of buckets */
+typedef struct memo_t {
+    struct memo_t* next;
+    size_t name;
+    size_t tag;
+    const char* items[];
+} memo_t;
+
+/* A query resolved against a schema. The name and tag are the index of a
+ * definition plus one, or zero to match anything. */
+typedef struct {
+    size_t name;
+    size_t tag;
+    bool valid;
+} query_t;
+
+#define OPT_MEMO_SLOTS 16
+
+/* An interned string. Nodes are prepended to their bucket with a compare and
+ * swap and never change once they are published. */
+typedef struct intern_node_t {
+    struct intern_node_t* next;
+    size_t hash;
+    size_t length;
+    char text[];
+} intern_node_t;
+
+struct opts_intern_t {
+    size_t mask;
+    intern_node_t** buckets;
+};
+
+/* Storage handed over by the caller of opts_ctx_init. Blocks are carved off
+ * the front in order and never freed one at a time. Everything below the mark
+ * belongs to the current parse result; what lies above it was claimed by
+ * queries and is given back when the next parse starts. */
+typedef struct {
+    char* base;
+    size_t size;
+    size_t top;
+    size_t mark;
+} arena_t;
+
+/* The parse result is stored as a set of parallel arrays. Options record the
+ * index of their definition, the argv index they were found at, and where
+ * their value lives. Arguments record only their argv index. Both are kept in
+ * the order they appeared on the command line. The items of list options are
+ * kept as spans within the elements, chained together per definition. When
+ * the command line was split out of a single buffer rather than given as argv,
+ * the elements are located by their offsets into that buffer instead. A
+ * context without an arena keeps all of this on the heap. Interned values are
+ * kept in a column of their own, allocated only once a value has been
+ * interned. An overlay borrows the schema of its base. */
+struct opts_ctx_t {
+    arena_t arena;
+    opts_intern_t* intern;
+    const opts_ctx_t* base;
+    schema_t schema;
+    const char* prog_name;
+    char** argv;
+    char* text;
+    size_t num_elems;
+    size_t elems_cap;
+    uint32_t* elems;
+    size_t num_opts;
+    size_t opts_cap;
+    uint16_t* opt_cfgs;
+    uint32_t* opt_argvs;
+    uint32_t* opt_offsets;
+    uint32_t* opt_lengths;
+    long* opt_ordinals;
+    const char** opt_values;
+    uint32_t* opt_last;
+    size_t dead_opts;
+    uint64_t* flags;
+    uint64_t* present;
+    size_t num_spans;
+    size_t spans_cap;
+    uint32_t* span_elems;
+    uint32_t* span_offsets;
+    uint32_t* span_lengths;
+    uint32_t* span_keys;
+    uint32_t* span_next;
+    uint32_t* list_heads;
+    uint32_t* list_tails;
+    size_t num_args;
+    size_t args_cap;
+    uint32_t* arg_argvs;
+    memo_t* memos[OPT_MEMO_SLOTS];
+};
+
+/* An entry recorded by a parallel parse, to be stored once the chunks are
+ * stitched back together in order */
+typedef struct {
+    enum { OPT_EVENT_OPTION, OPT_EVENT_ARGUMENT, OPT_EVENT_ERROR } kind;
+    uint16_t cfg;
+    uint32_t index;
+    uint32_t offset;
+    size_t length;
+    long ordinal;
+    const char* text;
+    const char* msg;
+} event_t;
+
+typedef struct {
+    const schema_t* schema;
+    opts_ctx_t* ctx;
+    uint64_t* present;
+    opts_opt_cbfn_t on_option;
+    opts_arg_cbfn_t on_argument;
+    void* user;
+    opts_err_cbfn_t err_cb;
+    size_t errors;
+    uint16_t pending;
+    uint32_t pending_argv;
+    bool discard;
+    bool record;
+    size_t num_events;
+    size_t events_cap;
+    event_t* events;
+#ifdef OPTS_METRICS
+    uint64_t start_ns;
+    uint64_t nested_ns;
+#endif
 } stream_ctx_t;
 
-static void opts_parse_short_option( stream_ctx_t* ctx );
-static void opts_parse_long_option( stream_ctx_t* ctx );
-static char* opts_parse_optarg(stream_ctx_t* ctx, char* opt_name);
-static void opts_parse_argument( stream_ctx_t* ctx );
+/* An option found in an element of a session, with the offset of its value in
+ * the text of the element */
+typedef struct {
+    uint16_t cfg;
+    uint32_t offset;
+    long ordinal;
+} occur_t;
+
+/* An element of a session. Each one records the option it was handed by the
+ * previous element and the option it leaves waiting for the next one, so an
+ * edit knows where its effects stop. It also keeps what parsing it found so
+ * that can be taken back out without parsing it again. */
+typedef struct {
+    char* text;
+    occur_t* opts;
+    uint32_t num_opts;
+    uint32_t errors;
+    uint16_t in;
+    uint16_t out;
+    bool arg;
+} elem_t;
+
+/* The elements are kept in a gap buffer which is moved to each edit. For each
+ * option the index of the element holding its last occurrence, plus one, is
+ * kept up to date by the edits. An option whose last occurrence was taken out
+ * is marked stale until the edit is done and the one before it is found. */
+struct opts_session_t {
+    schema_t schema;
+    opts_err_cbfn_t err_cb;
+    size_t cap;
+    size_t gap_start;
+    size_t gap_end;
+    elem_t* elems;
+    size_t* last;
+    uint64_t* stale;
+    size_t errors;
+    size_t num_args;
+    size_t events_cap;
+    event_t* events;
+    memo_t* memos;
+};
+
+#define OPT_NAME_MAX 256
+#define OPT_MAX_CFGS 0xFFFFu
+#define OPT_NO_VALUE 0xFFFFFFFFu
+#define OPT_NEXT_ARG 0x80000000u
+#define OPT_FLAG_WORDS(count) ((count) / 64 + 1)
+#define OPT_ALIGN 16u
+#define OPT_ALIGN_UP(size) (((size) + OPT_ALIGN - 1) & ~(size_t)(OPT_ALIGN - 1))
+
+static bool opts_ctx_start( opts_ctx_t* ctx, stream_ctx_t* stream, opts_cfg_t* opts,
+                            opts_err_cbfn_t err_cb );
+static bool opts_finish_parse( stream_ctx_t* stream );
+static void opts_add_element( stream_ctx_t* stream, char* elem );
+static char* opts_split_word( stream_ctx_t* stream, char** in, char* out );
+static const char* opts_element( const opts_ctx_t* ctx, size_t index );
+static bool opts_parse_parallel( stream_ctx_t* stream, int argc, char** argv );
+static void* opts_parse_chunk( void* arg );
+static event_t* opts_add_event( stream_ctx_t* ctx, int kind );
+static void opts_replay_events( stream_ctx_t* stream, const stream_ctx_t* chunk );
+static void opts_parse_element( stream_ctx_t* ctx, char* arg, uint32_t index );
+static void opts_parse_short_option( stream_ctx_t* ctx, char* arg, uint32_t index );
+static void opts_parse_long_option( stream_ctx_t* ctx, char* arg, uint32_t index );
+static void opts_parse_optarg( stream_ctx_t* ctx, uint16_t cfg, char* arg, uint32_t index,
+                               char* elem );
+static void opts_missing_optarg( stream_ctx_t* ctx, uint16_t cfg, uint32_t index );
+static void opts_report( stream_ctx_t* ctx, const char* msg, const char* name,
+                         size_t length );
 static void opts_parse_error(const char* msg, char* opt_name);
-static opts_cfg_t* opts_get_option_config( opts_cfg_t* opts, opt_type_t typ, char* name );
-static char* opts_next_token( stream_ctx_t* ctx );
-static void opts_consume_ws( stream_ctx_t* ctx );
-static char opts_next_char( stream_ctx_t* ctx );
-static char* opts_append_char( char* str, char ch );
-static char* strclone(const char* p_old);
-static void opts_add_option(char* name, char* tag, char* arg);
-static void opts_add_argument(char* arg);
+static bool opts_compile_schema( schema_t* schema, opts_cfg_t* opts, arena_t* arena );
+static void opts_free_schema( schema_t* schema, arena_t* arena );
+static size_t opts_find_config( const schema_t* schema, const char* name, size_t length );
+static size_t opts_find_tag( const schema_t* schema, const char* tag );
+static size_t opts_hash( const char* str, size_t length );
+static bool opts_compile_enum( perfect_t* perfect, const char** values, arena_t* arena );
+static bool opts_compile_rules( schema_t* schema, arena_t* arena );
+static const opts_rule_t* opts_rule_list( const schema_t* schema, size_t cfg );
+static void opts_check_rules( stream_ctx_t* stream );
+static uint64_t opts_given( const stream_ctx_t* stream, size_t word );
+static bool opts_hidden( const opts_ctx_t* ctx, uint16_t cfg );
+static void opts_merge_flags( opts_ctx_t* ctx );
+static void opts_rule_names( const schema_t* schema, const uint64_t* mask, char* buf,
+                             size_t size );
+static long opts_find_enum( const perfect_t* perfect, const char** values,
+                            const char* value );
+static uint32_t opts_seeded_hash( const char* str, size_t length, uint32_t seed );
+static unsigned int opts_char_class( char ch );
+static void opts_emit_option( stream_ctx_t* ctx, uint16_t cfg, uint32_t index,
+                              uint32_t offset, const char* value );
+static void opts_emit_argument( stream_ctx_t* ctx, char* arg, uint32_t index );
+static long opts_check_value( stream_ctx_t* ctx, uint16_t cfg, const char* value );
+static bool opts_store_option( opts_ctx_t* ctx, uint16_t cfg, uint32_t index,
+                               uint32_t offset, const char* value, size_t length,
+                               long ordinal );
+static bool opts_add_option( opts_ctx_t* ctx, uint16_t cfg, uint32_t index, uint32_t offset,
+                             uint32_t length, long ordinal, const char* interned );
+static bool opts_grow_options( opts_ctx_t* ctx );
+static bool opts_add_argument( opts_ctx_t* ctx, uint32_t index );
+static void opts_compact_options( opts_ctx_t* ctx );
+static bool opts_add_list( opts_ctx_t* ctx, uint16_t cfg, uint32_t index, uint32_t offset,
+                           const char* value, size_t length );
+static void opts_free_memos( opts_ctx_t* ctx );
+static void opts_ctx_clear( opts_ctx_t* ctx );
+static bool opts_grow( arena_t* arena, void* array, size_t old_cap, size_t cap,
+                       size_t size );
+static void* opts_alloc( arena_t* arena, void* old, size_t old_size, size_t size );
+static void* opts_alloc_shared( arena_t* arena, size_t size );
+static void opts_release( arena_t* arena, void* block );
+#ifdef OPTS_METRICS
+static uint64_t opts_clock( void );
+#endif
+static elem_t* opts_session_elem( const opts_session_t* session, size_t index );
+static bool opts_session_reserve( opts_session_t* session, size_t length );
+static void opts_session_move_gap( opts_session_t* session, size_t index );
+static void opts_session_apply( opts_session_t* session, elem_t* elem, size_t index );
+static void opts_session_retract( opts_session_t* session, elem_t* elem, size_t index );
+static void opts_session_shift( opts_session_t* session, size_t index, int delta );
+static void opts_session_find_last( opts_session_t* session );
+static bool opts_session_find( const opts_session_t* session, const query_t* query,
+                               occur_t* found, const char** text );
+static bool opts_session_kept( const opts_session_t* session, const elem_t* elem,
+                               size_t index, size_t opt );
+static const char* opts_session_value( const opts_session_t* session, const occur_t* occur,
+                                       const char* text );
+static void opts_session_free_results( opts_session_t* session );
+static uint16_t opts_session_trailing( const opts_session_t* session );
+static opts_cfg_t* opts_complete_find( opts_cfg_t* opts, const char* name, size_t length );
+static opts_cfg_t* opts_complete_lookup( opts_cfg_t* opts, const char* name,
+                                         size_t length );
+static opts_cfg_t* opts_complete_pending( opts_cfg_t* opts, const char* prev );
+static void opts_complete_names( FILE* ofile, opts_cfg_t* opts, const char* word );
+static void opts_complete_values( FILE* ofile, opts_cfg_t* cfg, const char* prefix,
+                                  size_t length, const char* word );
 
 /* Global State
  *****************************************************************************/
-static const char* Program_Name = NULL;
-static entry_t* Options   = NULL;
-static entry_t* Arguments = NULL;
+static opts_ctx_t Context;
 static opts_err_cbfn_t Error_Callback = &opts_parse_error;
+/* Stands in for the flags of a context that has not parsed anything yet. It
+ * covers every bit a schema can give out, so any bit reads as clear. */
+static const uint64_t No_Flags[OPT_FLAG_WORDS(OPT_MAX_CFGS)] = { 0 };
+static size_t Parallel_Min = 65536;
+static unsigned int Parallel_Threads = 0;
+
+#define OPT_MAX_THREADS 64
+
+/* Instrumentation compiles away entirely unless OPTS_METRICS is defined. The
+ * counters are shared by every context, and so by every thread. */
+#ifdef OPTS_METRICS
+static opts_metrics_t Metrics;
+#define METRIC_COUNT(field, n) \
+    ((void)__atomic_add_fetch(&Metrics.field, (n), __ATOMIC_RELAXED))
+#define METRIC_START(var)       uint64_t var = opts_clock()
+#define METRIC_STOP(field, var) METRIC_COUNT(field, opts_clock() - (var))
+/* Time spent looking up and storing entries is subtracted from the parse loop
+ * to give the time spent tokenizing */
+#define METRIC_PHASE(stream, field, var)     \
+    do {                                     \
+        uint64_t ns_ = opts_clock() - (var); \
+        METRIC_COUNT(field, ns_);            \
+        (stream)->nested_ns += ns_;          \
+    } while (0)
+#else
+#define METRIC_COUNT(field, n)           ((void)0)
+#define METRIC_START(var)                ((void)0)
+#define METRIC_STOP(field, var)          ((void)0)
+#define METRIC_PHASE(stream, field, var) ((void)0)
+#endif
 
 /* The Options Parser
  *****************************************************************************/
 void opts_parse(opts_cfg_t* opts, opts_err_cbfn_t err_cb, int argc, char** argv) {
-    /* Setup the stream */
-    stream_ctx_t ctx;
-    ctx.line_idx  = 0;
-    ctx.col_idx   = -1;
-    ctx.arg_count = argc-1;
-    ctx.arg_vect  = &argv[1];
-    ctx.options   = opts;
-    (void)opts_next_char( &ctx ); /* Loads up the first char */
-
     /* Record the error handler if one was provided */
     if (NULL != err_cb)
         Error_Callback = err_cb;
+    (void)opts_ctx_parse( &Context, opts, Error_Callback, argc, argv );
+}
 
-    /* Record the program name */
-    Program_Name = argv[0];
-
-    /* Until we run out of characters */
-    while (ctx.current != EOF) {
-        opts_consume_ws( &ctx );
-        /* If we have an option */
-        if ('-' == ctx.current) {
-            /* And it's a long one */
-            if ('-' == opts_next_char( &ctx )) {
-                /* Consume the second '-' */
-                opts_next_char( &ctx );
-                /* Parse the option */
-                opts_parse_long_option( &ctx );
-            } else {
-                /* Parse the option */
-                opts_parse_short_option( &ctx );
+bool opts_ctx_parse(opts_ctx_t* ctx, opts_cfg_t* opts, opts_err_cbfn_t err_cb,
+                    int argc, char** argv) {
+    stream_ctx_t stream;
+    int i;
+    if (!opts_ctx_start( ctx, &stream, opts, err_cb ))
+        return opts_finish_parse( &stream );
+    ctx->prog_name = argv[0];
+    ctx->argv      = argv;
+
+    /* Feed each argument through the parser */
+    if (!opts_parse_parallel( &stream, argc, argv ))
+        for (i = 1; i < argc; i++)
+            opts_parse_element( &stream, argv[i], i );
+    return opts_finish_parse( &stream );
+}
+
+void opts_parallel(size_t min_elems, unsigned int threads) {
+    Parallel_Min     = min_elems;
+    Parallel_Threads = threads;
+}
+
+void opts_parse_string(opts_cfg_t* opts, opts_err_cbfn_t err_cb, char* line) {
+    if (NULL != err_cb)
+        Error_Callback = err_cb;
+    (void)opts_ctx_parse_string( &Context, opts, Error_Callback, line );
+}
+
+bool opts_ctx_parse_string(opts_ctx_t* ctx, opts_cfg_t* opts, opts_err_cbfn_t err_cb,
+                           char* line) {
+    stream_ctx_t stream;
+    char* in  = line;
+    char* out = line;
+    if (!opts_ctx_start( ctx, &stream, opts, err_cb ))
+        return opts_finish_parse( &stream );
+    ctx->text = line;
+
+    /* Each word is written back over the text it was read from, so it is
+     * complete and terminated before the parser sees it */
+    for (;;) {
+        char* word = out;
+        while ((' ' == *in) || ('\t' == *in) || ('\n' == *in))
+            in++;
+        if ('\0' == *in)
+            break;
+        out = opts_split_word( &stream, &in, out );
+        opts_add_element( &stream, word );
+    }
+    return opts_finish_parse( &stream );
+}
+
+bool opts_parse_stream(opts_cfg_t* opts, opts_err_cbfn_t err_cb, int argc, char** argv,
+                       opts_opt_cbfn_t on_option, opts_arg_cbfn_t on_argument, void* user) {
+    stream_ctx_t ctx;
+    schema_t schema;
+    int i;
+    bool compiled;
+    METRIC_START(start);
+    compiled = opts_compile_schema( &schema, opts, NULL );
+    METRIC_STOP(lookup_ns, start);
+    ctx.schema      = &schema;
+    ctx.ctx         = NULL;
+    ctx.present     = NULL;
+    ctx.on_option   = on_option;
+    ctx.on_argument = on_argument;
+    ctx.user        = user;
+    ctx.err_cb      = (NULL != err_cb) ? err_cb : Error_Callback;
+    ctx.errors      = 0;
+    ctx.pending     = OPT_MAX_CFGS;
+    ctx.discard     = false;
+    ctx.record      = false;
+#ifdef OPTS_METRICS
+    ctx.nested_ns   = 0;
+    ctx.start_ns    = opts_clock();
+#endif
+
+    /* Hand each parsed entry to the callbacks as soon as it is complete */
+    if (!compiled)
+        opts_report( &ctx, "Out of storage", "", 0 );
+    for (i = 1; compiled && (i < argc); i++)
+        opts_parse_element( &ctx, argv[i], i );
+    (void)opts_finish_parse( &ctx );
+
+    opts_free_schema( &schema, NULL );
+    return (0 == ctx.errors);
+}
+
+bool opts_ctx_parse_stream(opts_ctx_t* ctx, opts_cfg_t* opts, opts_err_cbfn_t err_cb,
+                           int argc, char** argv, opts_opt_cbfn_t on_option,
+                           opts_arg_cbfn_t on_argument, void* user) {
+    stream_ctx_t stream;
+    int i;
+    if (!opts_ctx_start( ctx, &stream, opts, err_cb ))
+        return opts_finish_parse( &stream );
+
+    /* Only the lookup tables of the context and the record of which options
+     * were given are used, the entries go straight to the callbacks */
+    stream.ctx         = NULL;
+    stream.on_option   = on_option;
+    stream.on_argument = on_argument;
+    stream.user        = user;
+    for (i = 1; i < argc; i++)
+        opts_parse_element( &stream, argv[i], i );
+    return opts_finish_parse( &stream );
+}
+
+bool opts_ctx_parse_buffer(opts_ctx_t* ctx, opts_cfg_t* opts, opts_err_cbfn_t err_cb,
+                           const char* buf, size_t length) {
+    stream_ctx_t stream;
+    /* The text of a context is shared with opts_ctx_parse_string, which
+     * writes to it, but elements that are already split are only read */
+    char* elem = (char*)buf;
+    char* end  = elem + length;
+    char* next;
+    if (!opts_ctx_start( ctx, &stream, opts, err_cb ))
+        return opts_finish_parse( &stream );
+    ctx->text = elem;
+
+    /* The elements are already terminated so they only need to be found */
+    while ((elem < end) &&
+           (NULL != (next = (char*)memchr(elem, '\0', (size_t)(end - elem))))) {
+        opts_add_element( &stream, elem );
+        elem = next + 1;
+    }
+    if (elem < end)
+        opts_report( &stream, "Unterminated element", elem, (size_t)(end - elem) );
+    return opts_finish_parse( &stream );
+}
+
+/* Every parse into a context starts from an empty result. Returns false if
+ * there was no room for the lookup tables, leaving the context empty. */
+static bool opts_ctx_start( opts_ctx_t* ctx, stream_ctx_t* stream, opts_cfg_t* opts,
+                            opts_err_cbfn_t err_cb ) {
+    stream->schema  = &ctx->schema;
+    stream->ctx     = ctx;
+    stream->present = NULL;
+    stream->err_cb  = (NULL != err_cb) ? err_cb : &opts_parse_error;
+    stream->errors  = 0;
+    stream->pending = OPT_MAX_CFGS;
+    stream->discard = false;
+    stream->record  = false;
+#ifdef OPTS_METRICS
+    stream->nested_ns = 0;
+    stream->start_ns  = opts_clock();
+#endif
+    /* An overlay cannot replace the tables it shares with its base, so it
+     * keeps its previous result instead */
+    if ((ctx->schema.options != opts) && (NULL != ctx->base)) {
+        opts_report( stream, "Options differ from those of the base", "", 0 );
+        return false;
+    }
+    ctx->prog_name  = NULL;
+    ctx->argv       = NULL;
+    ctx->text       = NULL;
+    ctx->num_elems  = 0;
+    ctx->num_args   = 0;
+    opts_free_memos( ctx );
+
+    /* Build the lookup tables for the option definitions */
+    if (ctx->schema.options != opts) {
+        arena_t* arena = &ctx->arena;
+        size_t count;
+        bool ok;
+        METRIC_START(start);
+        /* The old tables cannot be handed back to an arena on their own, so
+         * the whole of it is started over */
+        if (NULL != arena->base)
+            opts_ctx_clear( ctx );
+        else
+            opts_free_schema( &ctx->schema, arena );
+        ok    = opts_compile_schema( &ctx->schema, opts, arena );
+        count = ctx->schema.count + 1;
+        ok    = ok && opts_grow(arena, &ctx->opt_last, 0, count, sizeof(uint32_t))
+                   && opts_grow(arena, &ctx->flags, 0,
+                                OPT_FLAG_WORDS(ctx->schema.num_flags), sizeof(uint64_t))
+                   && opts_grow(arena, &ctx->present, 0,
+                                OPT_FLAG_WORDS(ctx->schema.count), sizeof(uint64_t))
+                   && opts_grow(arena, &ctx->list_heads, 0, count, sizeof(uint32_t))
+                   && opts_grow(arena, &ctx->list_tails, 0, count, sizeof(uint32_t));
+        METRIC_STOP(lookup_ns, start);
+        if (!ok) {
+            opts_ctx_clear( ctx );
+            opts_report( stream, "Out of storage", "", 0 );
+            return false;
+        }
+        memset(ctx->opt_last, 0, count * sizeof(uint32_t));
+        memset(ctx->list_heads, 0, count * sizeof(uint32_t));
+    } else {
+        /* Only the options of the previous result can have a last slot or
+         * a list of items */
+        size_t opt;
+        for (opt = 0; opt < ctx->num_opts; opt++) {
+            if (OPT_MAX_CFGS != ctx->opt_cfgs[opt]) {
+                ctx->opt_last[ctx->opt_cfgs[opt]]   = 0;
+                ctx->list_heads[ctx->opt_cfgs[opt]] = 0;
             }
+        }
+    }
+    ctx->num_spans = 0;
+    ctx->num_opts  = 0;
+    ctx->dead_opts = 0;
+    memset(ctx->flags, 0, OPT_FLAG_WORDS(ctx->schema.num_flags) * sizeof(uint64_t));
+    memset(ctx->present, 0, OPT_FLAG_WORDS(ctx->schema.count) * sizeof(uint64_t));
+    stream->present = ctx->present;
+    return true;
+}
+
+static bool opts_finish_parse( stream_ctx_t* stream ) {
+    /* Make sure the last option got the argument it expected */
+    if (OPT_MAX_CFGS != stream->pending)
+        opts_missing_optarg( stream, stream->pending, stream->pending_argv );
+    if ((NULL != stream->ctx) && (0 != stream->ctx->dead_opts))
+        opts_compact_options( stream->ctx );
+    if ((NULL != stream->ctx) && (NULL != stream->ctx->base))
+        opts_merge_flags( stream->ctx );
+    if ((NULL != stream->present) && (0 != stream->schema->num_rules))
+        opts_check_rules( stream );
+    /* Queries claim their storage above everything the parse has used */
+    if (NULL != stream->ctx)
+        stream->ctx->arena.mark = stream->ctx->arena.top;
+    METRIC_STOP(tokenize_ns, stream->start_ns + stream->nested_ns);
+    return (0 == stream->errors);
+}
+
+/* Records where an element split out of the context's text starts and hands
+ * it to the parser. The first element is the program name. */
+static void opts_add_element( stream_ctx_t* stream, char* elem ) {
+    opts_ctx_t* ctx = stream->ctx;
+    uint32_t index  = (uint32_t)ctx->num_elems;
+    if (ctx->num_elems == ctx->elems_cap) {
+        size_t cap = (0 == ctx->elems_cap) ? 16 : 2 * ctx->elems_cap;
+        if (!opts_grow(&ctx->arena, &ctx->elems, ctx->elems_cap, cap, sizeof(uint32_t))) {
+            opts_report( stream, "Out of storage", elem, strlen(elem) );
+            return;
+        }
+        ctx->elems_cap = cap;
+    }
+    ctx->elems[ctx->num_elems++] = (uint32_t)(elem - ctx->text);
+    if (0 == index)
+        ctx->prog_name = elem;
+    else
+        opts_parse_element( stream, elem, index );
+}
+
+/* Copies one word from *in down to out, following the quoting rules of the
+ * POSIX shell: a backslash escapes the next character, single quotes preserve
+ * everything up to the closing quote, and inside double quotes a backslash
+ * only escapes '$', '`', '"', '\' and newline. Returns the position after the
+ * terminating NUL. */
+static char* opts_split_word( stream_ctx_t* stream, char** in, char* out ) {
+    char* word  = out;
+    char* curr  = *in;
+    char  quote = '\0';
+    bool  more;
+    for (; '\0' != *curr; curr++) {
+        if ('\'' == quote) {
+            if ('\'' == *curr)
+                quote = '\0';
+            else
+                *out++ = *curr;
+        } else if (('\\' == *curr) && ('\0' != curr[1]) &&
+                   (('\0' == quote) || (NULL != strchr("$`\"\\\n", curr[1])))) {
+            /* An escaped newline joins the lines together */
+            if ('\n' != *++curr)
+                *out++ = *curr;
+        } else if ('"' == quote) {
+            if ('"' == *curr)
+                quote = '\0';
+            else
+                *out++ = *curr;
+        } else if (('\'' == *curr) || ('"' == *curr)) {
+            quote = *curr;
+        } else if ((' ' == *curr) || ('\t' == *curr) || ('\n' == *curr)) {
+            break;
         } else {
-            /* It's not an option so add it to the "extra" bucket */
-            opts_parse_argument( &ctx );
-        }
-    }
-}
-
-static void opts_parse_short_option( stream_ctx_t* ctx ) {
-    char opt[2] = { ctx->current, '\0' };
-    char* opt_name = strclone(opt);
-    opts_cfg_t* config = opts_get_option_config( ctx->options, SHORT, opt_name );
-    if (config != NULL) {
-        char* opt_arg = NULL;
-        (void)opts_next_char( ctx );
-        /* Check if the flag has an argument */
-        if (config->has_arg)
-            opt_arg = opts_parse_optarg( ctx, opt_name );
-        /* If there are more flags in the flag group */
-        else if ((' ' != ctx->current) && (EOF != ctx->current))
-            opts_parse_short_option( ctx );
-        opts_add_option( opt_name, config->tag, opt_arg );
+            *out++ = *curr;
+        }
+    }
+    if ('\0' != quote)
+        opts_report( stream, "Unterminated quote", word, (size_t)(out - word) );
+    /* The terminator may land on the separator, so check for it first */
+    more    = ('\0' != *curr);
+    *out++  = '\0';
+    *in     = (more) ? curr + 1 : curr;
+    return out;
+}
+
+static const char* opts_element( const opts_ctx_t* ctx, size_t index ) {
+    return (NULL != ctx->argv) ? ctx->argv[index] : ctx->text + ctx->elems[index];
+}
+
+/* Parallel Parsing
+ *****************************************************************************/
+/* Whether an element is the value of an option depends only on the element
+ * before it, so argv can be cut into chunks that are parsed independently.
+ * Each chunk first replays the element before it, discarding the result, to
+ * learn whether it starts with an option waiting for its value. Entries and
+ * errors are recorded rather than stored, and the chunks are then stitched
+ * together by replaying their records in order, which gives exactly the
+ * result and the errors of a sequential parse. The records live on the heap, so
+ * a context parsing into caller storage is always parsed sequentially. */
+typedef struct {
+    stream_ctx_t stream;
+    char** argv;
+    uint32_t begin;
+    uint32_t end;
+    pthread_t thread;
+    bool joinable;
+} chunk_t;
+
+static bool opts_parse_parallel( stream_ctx_t* stream, int argc, char** argv ) {
+    chunk_t chunks[OPT_MAX_THREADS];
+    size_t count = (argc > 1) ? (size_t)argc - 1 : 0;
+    long threads;
+    size_t i;
+    if ((count < Parallel_Min) || (NULL != stream->ctx->arena.base))
+        return false;
+    /* Asking for the processor count costs more than parsing a short command
+     * line, so it is left until the command line is known to be long */
+    threads = (0 != Parallel_Threads) ? (long)Parallel_Threads
+                                      : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 2)
+        return false;
+    if (threads > OPT_MAX_THREADS)
+        threads = OPT_MAX_THREADS;
+    if ((size_t)threads > count)
+        threads = (long)count;
+
+    for (i = 0; i < (size_t)threads; i++) {
+        chunk_t* chunk = &chunks[i];
+        memset(&chunk->stream, 0, sizeof(stream_ctx_t));
+        chunk->stream.schema  = stream->schema;
+        chunk->stream.pending = OPT_MAX_CFGS;
+        chunk->stream.record  = true;
+        chunk->argv  = argv;
+        chunk->begin = (uint32_t)(1 + i * count / threads);
+        chunk->end   = (uint32_t)(1 + (i + 1) * count / threads);
+        chunk->joinable = (i > 0) && (0 == pthread_create(&chunk->thread, NULL,
+                                                          &opts_parse_chunk, chunk));
+    }
+    /* The calling thread takes the first chunk, and any a thread could not
+     * be started for */
+    for (i = 0; i < (size_t)threads; i++)
+        if (!chunks[i].joinable)
+            (void)opts_parse_chunk( &chunks[i] );
+    for (i = 0; i < (size_t)threads; i++) {
+        if (chunks[i].joinable)
+            pthread_join(chunks[i].thread, NULL);
+        opts_replay_events( stream, &chunks[i].stream );
+        /* A chunk that could not record everything stopped recording */
+        if (chunks[i].stream.discard)
+            opts_report( stream, "Out of storage", argv[chunks[i].begin],
+                         strlen(argv[chunks[i].begin]) );
+        free(chunks[i].stream.events);
+    }
+
+    /* The last chunk may end with an option still waiting for its value */
+    stream->pending      = chunks[threads-1].stream.pending;
+    stream->pending_argv = chunks[threads-1].stream.pending_argv;
+    return true;
+}
+
+static void* opts_parse_chunk( void* arg ) {
+    chunk_t* chunk = (chunk_t*)arg;
+    stream_ctx_t* stream = &chunk->stream;
+    uint32_t i;
+    if (chunk->begin > 1) {
+        stream->discard = true;
+        opts_parse_element( stream, chunk->argv[chunk->begin-1], chunk->begin-1 );
+        stream->discard = false;
+    }
+    for (i = chunk->begin; i < chunk->end; i++)
+        opts_parse_element( stream, chunk->argv[i], i );
+    return NULL;
+}
+
+static event_t* opts_add_event( stream_ctx_t* ctx, int kind ) {
+    event_t* event;
+    if (ctx->num_events == ctx->events_cap) {
+        size_t cap = (0 == ctx->events_cap) ? 256 : 2 * ctx->events_cap;
+        if (!opts_grow(NULL, &ctx->events, ctx->events_cap, cap, sizeof(event_t))) {
+            ctx->discard = true;
+            return NULL;
+        }
+        ctx->events_cap = cap;
+    }
+    event = &ctx->events[ctx->num_events++];
+    event->kind = kind;
+    return event;
+}
+
+static void opts_replay_events( stream_ctx_t* stream, const stream_ctx_t* chunk ) {
+    size_t i;
+    for (i = 0; i < chunk->num_events; i++) {
+        const event_t* event = &chunk->events[i];
+        switch (event->kind) {
+            case OPT_EVENT_OPTION:
+                if (!opts_store_option( stream->ctx, event->cfg, event->index,
+                                        event->offset, event->text, event->length,
+                                        event->ordinal ))
+                    opts_report( stream, "Out of storage",
+                                 stream->schema->options[event->cfg].name,
+                                 stream->schema->lengths[event->cfg] );
+                break;
+
+            case OPT_EVENT_ARGUMENT:
+                if (!opts_add_argument( stream->ctx, event->index ))
+                    opts_report( stream, "Out of storage", stream->ctx->argv[event->index],
+                                 strlen(stream->ctx->argv[event->index]) );
+                break;
+
+            case OPT_EVENT_ERROR:
+                opts_report( stream, event->msg, event->text, event->length );
+                break;
+        }
+    }
+}
+
+/* Element Parsing
+ *****************************************************************************/
+static void opts_parse_element( stream_ctx_t* ctx, char* arg, uint32_t index ) {
+    METRIC_COUNT(chars, strlen(arg));
+    /* If the previous option expects an argument then this is it */
+    if (OPT_MAX_CFGS != ctx->pending) {
+        uint16_t cfg = ctx->pending;
+        ctx->pending = OPT_MAX_CFGS;
+        if ('-' != arg[0]) {
+            opts_emit_option( ctx, cfg, ctx->pending_argv, OPT_NEXT_ARG, arg );
+            return;
+        }
+        opts_missing_optarg( ctx, cfg, ctx->pending_argv );
+    }
+
+    /* If we have an option */
+    if (('-' == arg[0]) && ('\0' != arg[1])) {
+        /* And it's a long one */
+        if ('-' == arg[1])
+            opts_parse_long_option( ctx, arg, index );
+        else
+            opts_parse_short_option( ctx, arg, index );
     } else {
-        Error_Callback("Unknown Option", opt_name);
+        /* It's not an option so add it to the "extra" bucket */
+        opts_emit_argument( ctx, arg, index );
+    }
+}
+
+static void opts_parse_short_option( stream_ctx_t* ctx, char* arg, uint32_t index ) {
+    const schema_t* schema = ctx->schema;
+    char* curr;
+    for (curr = &arg[1]; '\0' != *curr; curr++) {
+        METRIC_START(start);
+        size_t cfg = opts_find_config( schema, curr, 1 );
+        METRIC_PHASE(ctx, lookup_ns, start);
+        if (0 == cfg) {
+            opts_report(ctx, "Unknown Option", curr, 1);
+            return;
+        } else if (schema->options[cfg-1].has_arg) {
+            /* The rest of the flag group is the argument */
+            opts_parse_optarg( ctx, cfg-1, &curr[1], index, arg );
+            return;
+        } else {
+            opts_emit_option( ctx, cfg-1, index, OPT_NO_VALUE, NULL );
+        }
     }
 }
 
-static void opts_parse_long_option( stream_ctx_t* ctx ) {
-    char* opt_name = opts_next_token( ctx );
-    opts_cfg_t* config = opts_get_option_config( ctx->options, LONG, opt_name );
-    if (config != NULL) {
-        char* opt_arg = NULL;
+static void opts_parse_long_option( stream_ctx_t* ctx, char* arg, uint32_t index ) {
+    const schema_t* schema = ctx->schema;
+    char* name  = &arg[2];
+    char* value = strchr(name, '=');
+    size_t length = (NULL == value) ? strlen(name) : (size_t)(value - name);
+    METRIC_START(start);
+    size_t cfg = opts_find_config( schema, name, length );
+    METRIC_PHASE(ctx, lookup_ns, start);
+    if ((0 == cfg) || (1 == length)) {
+        opts_report(ctx, "Unknown Option", name, length);
+    } else if (schema->options[cfg-1].has_arg) {
         /* Parse the argument if one is expected */
-        if (config->has_arg)
-            opt_arg = opts_parse_optarg( ctx, opt_name );
-        /* Store off the option value */
-        opts_add_option( opt_name, config->tag, opt_arg );
+        opts_parse_optarg( ctx, cfg-1, value, index, arg );
+    } else if ((NULL != value) && ('\0' != value[1])) {
+        opts_report(ctx, "Unexpected argument", name, length);
     } else {
-        Error_Callback("Unknown Option", opt_name);
+        opts_emit_option( ctx, cfg-1, index, OPT_NO_VALUE, NULL );
     }
 }
 
-static char* opts_parse_optarg(stream_ctx_t* ctx, char* opt_name) {
-    opts_consume_ws( ctx );
-    if (('-' == ctx->current) || (EOF == ctx->current))
-        Error_Callback("Expected an argument, none received", opt_name);
-    return opts_next_token( ctx );
+static void opts_parse_optarg( stream_ctx_t* ctx, uint16_t cfg, char* arg, uint32_t index,
+                               char* elem ) {
+    if ((NULL != arg) && ('=' == *arg))
+        arg++;
+    /* The argument is either attached or will be the next element */
+    if ((NULL == arg) || ('\0' == *arg)) {
+        ctx->pending      = cfg;
+        ctx->pending_argv = index;
+    } else if ('-' == *arg) {
+        opts_missing_optarg( ctx, cfg, index );
+    } else {
+        opts_emit_option( ctx, cfg, index, (uint32_t)(arg - elem), arg );
+    }
+}
+
+static void opts_missing_optarg( stream_ctx_t* ctx, uint16_t cfg, uint32_t index ) {
+    const char* name = ctx->schema->options[cfg].name;
+    opts_report(ctx, "Expected an argument, none received", name, strlen(name));
+    opts_emit_option( ctx, cfg, index, OPT_NO_VALUE, NULL );
+}
+
+static void opts_report( stream_ctx_t* ctx, const char* msg, const char* name,
+                         size_t length ) {
+    char opt_name[OPT_NAME_MAX];
+    if (ctx->discard) {
+        return;
+    } else if (ctx->record) {
+        event_t* event = opts_add_event( ctx, OPT_EVENT_ERROR );
+        if (NULL != event) {
+            event->msg    = msg;
+            event->text   = name;
+            event->length = length;
+        }
+        return;
+    }
+    if (length >= OPT_NAME_MAX)
+        length = OPT_NAME_MAX - 1;
+    memcpy(opt_name, name, length);
+    opt_name[length] = '\0';
+    ctx->errors++;
+    ctx->err_cb(msg, opt_name);
 }
 
 static void opts_parse_error(const char* msg, char* opt_name) {
     fprintf(stderr, "Option '%s' : %s\n", opt_name, msg);
-    free(opt_name);
     opts_reset();
     exit(1);
 }
 
-static void opts_parse_argument( stream_ctx_t* ctx ) {
-    char* arg_val = opts_next_token( ctx );
-    if (NULL != arg_val)
-        opts_add_argument(arg_val);
+/* Parsed entries are either stored in the context or handed straight to the
+ * callbacks of a streaming parse */
+static void opts_emit_option( stream_ctx_t* ctx, uint16_t cfg, uint32_t index,
+                              uint32_t offset, const char* value ) {
+    size_t length;
+    long ordinal;
+    if (ctx->discard)
+        return;
+    length  = (NULL == value) ? 0 : strlen(value);
+    ordinal = opts_check_value( ctx, cfg, value );
+    if (ctx->record) {
+        event_t* event = opts_add_event( ctx, OPT_EVENT_OPTION );
+        if (NULL != event) {
+            event->cfg     = cfg;
+            event->index   = index;
+            event->offset  = offset;
+            event->length  = length;
+            event->ordinal = ordinal;
+            event->text    = value;
+        }
+    } else if (NULL != ctx->ctx) {
+        METRIC_START(start);
+        bool stored = opts_store_option( ctx->ctx, cfg, index, offset, value, length,
+                                         ordinal );
+        METRIC_PHASE(ctx, store_ns, start);
+        if (!stored)
+            opts_report( ctx, "Out of storage", ctx->schema->options[cfg].name,
+                         ctx->schema->lengths[cfg] );
+    } else {
+        opts_cfg_t* config = &ctx->schema->options[cfg];
+        if (NULL != ctx->present)
+            ctx->present[cfg / 64] |= (uint64_t)1 << (cfg % 64);
+        if (NULL == ctx->on_option)
+            return;
+        if (NULL == value) {
+            value  = config->name;
+            length = ctx->schema->lengths[cfg];
+        }
+        ctx->on_option( ctx->user, config, value, length, (int)index );
+    }
+}
+
+static void opts_emit_argument( stream_ctx_t* ctx, char* arg, uint32_t index ) {
+    if (ctx->discard) {
+        return;
+    } else if (ctx->record) {
+        event_t* event = opts_add_event( ctx, OPT_EVENT_ARGUMENT );
+        if (NULL != event)
+            event->index = index;
+    } else if (NULL != ctx->ctx) {
+        METRIC_START(start);
+        bool stored = opts_add_argument( ctx->ctx, index );
+        METRIC_PHASE(ctx, store_ns, start);
+        if (!stored)
+            opts_report( ctx, "Out of storage", arg, strlen(arg) );
+    } else if (NULL != ctx->on_argument)
+        ctx->on_argument( ctx->user, arg, (int)index );
 }
 
-static opts_cfg_t* opts_get_option_config( opts_cfg_t* opts, opt_type_t type, char* name ) {
-    opts_cfg_t* cfg = NULL;
-    int i = 0;
-    while( opts[i].name != NULL ) {
-        opt_type_t curr_type = (strlen(opts[i].name) > 1) ? LONG : SHORT;
-        if ((curr_type == type) && (0 == strcmp(opts[i].name, name))) {
-            cfg = &(opts[i]);
+/* Validates the value against the constraint of its option, if it has one,
+ * and returns the ordinal it resolves to. */
+static long opts_check_value( stream_ctx_t* ctx, uint16_t cfg, const char* value ) {
+    const opts_constraint_t* constraint = ctx->schema->options[cfg].constraint;
+    const char* msg = NULL;
+    long ordinal = -1;
+    if ((NULL == constraint) || (NULL == value))
+        return ordinal;
+    switch (constraint->kind) {
+        case OPTS_ENUM:
+            ordinal = opts_find_enum( &ctx->schema->enums[cfg], constraint->values, value );
+            msg = (ordinal < 0) ? "Value is not one of the allowed choices" : NULL;
+            break;
+
+        case OPTS_RANGE: {
+            char* end = NULL;
+            errno   = 0;
+            ordinal = strtol(value, &end, 10);
+            if (('\0' == *value) || ('\0' != *end) || (ERANGE == errno) ||
+                (ordinal < constraint->min) || (ordinal > constraint->max)) {
+                msg = "Value is not an integer in the allowed range";
+                ordinal = -1;
+            }
+            break;
+        }
+
+        case OPTS_CLASS: {
+            const char* curr = value;
+            while ((0 != (opts_char_class(*curr) & constraint->chars)))
+                curr++;
+            if (('\0' == *value) || ('\0' != *curr))
+                msg = "Value contains characters that are not allowed";
             break;
         }
-        i++;
+
+        default:
+            break;
     }
-    return cfg;
+    if (NULL != msg) {
+        const char* name = ctx->schema->options[cfg].name;
+        opts_report( ctx, msg, name, strlen(name) );
+    }
+    return ordinal;
+}
+
+/* Returns false if the context ran out of room to store the option */
+static bool opts_store_option( opts_ctx_t* ctx, uint16_t cfg, uint32_t index,
+                               uint32_t offset, const char* value, size_t length,
+                               long ordinal ) {
+    const char* interned = NULL;
+    if ((NULL != ctx->intern) && (NULL != value) &&
+        (NULL == (interned = opts_intern(ctx->intern, value))))
+        return false;
+    if (!opts_add_option( ctx, cfg, index, offset, length, ordinal, interned ))
+        return false;
+    if (('\0' != ctx->schema.options[cfg].delim) && (NULL != value))
+        return opts_add_list( ctx, cfg, index, offset, value, length );
+    return true;
 }
 
-static char* opts_next_token( stream_ctx_t* ctx ) {
-    char* tok = NULL;
+static bool opts_add_option( opts_ctx_t* ctx, uint16_t cfg, uint32_t index, uint32_t offset,
+                             uint32_t length, long ordinal, const char* interned ) {
+    /* A single valued option replaces its previous occurrence, which is left
+     * behind as a gap until there are enough gaps to be worth closing. Lists
+     * always keep every occurrence since their items are merged */
+    const opts_cfg_t* config = &ctx->schema.options[cfg];
+    bool single = !config->multi && ('\0' == config->delim);
+    bool room;
+    if (single) {
+        if (0 != ctx->opt_last[cfg]) {
+            ctx->opt_cfgs[ctx->opt_last[cfg]-1] = OPT_MAX_CFGS;
+            ctx->dead_opts++;
+        }
+        ctx->opt_last[cfg] = ctx->num_opts + 1;
+        if ((ctx->num_opts == ctx->opts_cap) && (2 * ctx->dead_opts >= ctx->num_opts)) {
+            opts_compact_options( ctx );
+            ctx->opt_last[cfg] = ctx->num_opts + 1;
+        }
+    }
+    room = (ctx->num_opts < ctx->opts_cap) || opts_grow_options( ctx );
+    /* Ordinals are only stored when the schema has constraints */
+    if (room && ctx->schema.constrained && (NULL == ctx->opt_ordinals))
+        room = opts_grow(&ctx->arena, &ctx->opt_ordinals, 0, ctx->opts_cap, sizeof(long));
+    /* Entries stored before the first interned value have none */
+    if (room && (NULL != interned) && (NULL == ctx->opt_values)) {
+        room = opts_grow(&ctx->arena, &ctx->opt_values, 0, ctx->opts_cap,
+                         sizeof(const char*));
+        if (room)
+            memset((void*)ctx->opt_values, 0, ctx->opts_cap * sizeof(const char*));
+    }
+    if (!room) {
+        /* The previous occurrence is already gone, so this one is lost too */
+        if (single)
+            ctx->opt_last[cfg] = 0;
+        return false;
+    }
+    if (ctx->schema.constrained)
+        ctx->opt_ordinals[ctx->num_opts] = ordinal;
+    if (NULL != ctx->opt_values)
+        ctx->opt_values[ctx->num_opts] = interned;
+    if (OPT_MAX_CFGS != ctx->schema.flag_bits[cfg]) {
+        uint16_t bit = ctx->schema.flag_bits[cfg];
+        ctx->flags[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+    ctx->present[cfg / 64] |= (uint64_t)1 << (cfg % 64);
+    ctx->opt_cfgs[ctx->num_opts]    = cfg;
+    ctx->opt_argvs[ctx->num_opts]   = index;
+    ctx->opt_offsets[ctx->num_opts] = offset;
+    ctx->opt_lengths[ctx->num_opts] = length;
+    ctx->num_opts++;
+    return true;
+}
 
-    opts_consume_ws( ctx );
-    if (EOF != ctx->current) {
-        // Setup the string
-        tok = (char*)malloc(2);
-        tok[0] = ctx->current;
-        tok[1] = '\0';
+/* The columns are grown one at a time and the capacity only raised once all
+ * of them have grown, so running out of room part way leaves them usable */
+static bool opts_grow_options( opts_ctx_t* ctx ) {
+    arena_t* arena = &ctx->arena;
+    size_t cap = (0 == ctx->opts_cap) ? 16 : 2 * ctx->opts_cap;
+    if (!opts_grow(arena, &ctx->opt_cfgs,    ctx->opts_cap, cap, sizeof(uint16_t)) ||
+        !opts_grow(arena, &ctx->opt_argvs,   ctx->opts_cap, cap, sizeof(uint32_t)) ||
+        !opts_grow(arena, &ctx->opt_offsets, ctx->opts_cap, cap, sizeof(uint32_t)) ||
+        !opts_grow(arena, &ctx->opt_lengths, ctx->opts_cap, cap, sizeof(uint32_t)))
+        return false;
+    if ((NULL != ctx->opt_ordinals) &&
+        !opts_grow(arena, &ctx->opt_ordinals, ctx->opts_cap, cap, sizeof(long)))
+        return false;
+    if ((NULL != ctx->opt_values) &&
+        !opts_grow(arena, &ctx->opt_values, ctx->opts_cap, cap, sizeof(const char*)))
+        return false;
+    ctx->opts_cap = cap;
+    return true;
+}
 
-        (void)opts_next_char( ctx );
-        while ((EOF != ctx->current) && (' ' != ctx->current)) {
-            tok = opts_append_char( tok, ctx->current );
-            (void)opts_next_char( ctx );
+/* Splits the value of a list option into spans and appends them to the list
+ * of its definition, so repeated occurrences form one list */
+static bool opts_add_list( opts_ctx_t* ctx, uint16_t cfg, uint32_t index, uint32_t offset,
+                           const char* value, size_t length ) {
+    const opts_cfg_t* config = &ctx->schema.options[cfg];
+    const char* end  = value + length;
+    const char* item = value;
+    uint32_t elem = (offset & OPT_NEXT_ARG) ? index + 1 : index;
+    uint32_t base = offset & ~OPT_NEXT_ARG;
+    for (;;) {
+        const char* next = (const char*)memchr(item, config->delim, (size_t)(end - item));
+        const char* stop = (NULL == next) ? end : next;
+        const char* equals;
+        if (ctx->num_spans == ctx->spans_cap) {
+            arena_t* arena = &ctx->arena;
+            size_t cap = (0 == ctx->spans_cap) ? 16 : 2 * ctx->spans_cap;
+            size_t old = ctx->spans_cap;
+            if (!opts_grow(arena, &ctx->span_elems,   old, cap, sizeof(uint32_t)) ||
+                !opts_grow(arena, &ctx->span_offsets, old, cap, sizeof(uint32_t)) ||
+                !opts_grow(arena, &ctx->span_lengths, old, cap, sizeof(uint32_t)) ||
+                !opts_grow(arena, &ctx->span_keys,    old, cap, sizeof(uint32_t)) ||
+                !opts_grow(arena, &ctx->span_next,    old, cap, sizeof(uint32_t)))
+                return false;
+            ctx->spans_cap = cap;
         }
+        equals = (config->pairs) ? (const char*)memchr(item, '=', (size_t)(stop - item))
+                                 : NULL;
+        ctx->span_elems[ctx->num_spans]   = elem;
+        ctx->span_offsets[ctx->num_spans] = base + (uint32_t)(item - value);
+        ctx->span_lengths[ctx->num_spans] = (uint32_t)(stop - item);
+        ctx->span_keys[ctx->num_spans]    = (NULL == equals) ? OPT_NO_VALUE
+                                                             : (uint32_t)(equals - item);
+        ctx->span_next[ctx->num_spans]    = 0;
+        if (0 == ctx->list_heads[cfg])
+            ctx->list_heads[cfg] = ctx->num_spans + 1;
+        else
+            ctx->span_next[ctx->list_tails[cfg]-1] = ctx->num_spans + 1;
+        ctx->list_tails[cfg] = ++ctx->num_spans;
+        if (NULL == next)
+            return true;
+        item = next + 1;
     }
-    return tok;
 }
 
-static void opts_consume_ws( stream_ctx_t* ctx ) {
-    while (' ' == ctx->current)
-        (void)opts_next_char( ctx );
+/* Closes the gaps left by replaced options, keeping the rest in order */
+static void opts_compact_options( opts_ctx_t* ctx ) {
+    size_t opt, live = 0;
+    for (opt = 0; opt < ctx->num_opts; opt++) {
+        uint16_t cfg = ctx->opt_cfgs[opt];
+        if (OPT_MAX_CFGS == cfg)
+            continue;
+        ctx->opt_cfgs[live]    = cfg;
+        ctx->opt_argvs[live]   = ctx->opt_argvs[opt];
+        ctx->opt_offsets[live] = ctx->opt_offsets[opt];
+        ctx->opt_lengths[live] = ctx->opt_lengths[opt];
+        if (NULL != ctx->opt_ordinals)
+            ctx->opt_ordinals[live] = ctx->opt_ordinals[opt];
+        if (NULL != ctx->opt_values)
+            ctx->opt_values[live] = ctx->opt_values[opt];
+        if (!ctx->schema.options[cfg].multi)
+            ctx->opt_last[cfg] = live + 1;
+        live++;
+    }
+    ctx->num_opts  = live;
+    ctx->dead_opts = 0;
+}
+
+static bool opts_add_argument( opts_ctx_t* ctx, uint32_t index ) {
+    if (ctx->num_args == ctx->args_cap) {
+        size_t cap = (0 == ctx->args_cap) ? 16 : 2 * ctx->args_cap;
+        if (!opts_grow(&ctx->arena, &ctx->arg_argvs, ctx->args_cap, cap, sizeof(uint32_t)))
+            return false;
+        ctx->args_cap = cap;
+    }
+    ctx->arg_argvs[ctx->num_args++] = index;
+    return true;
 }
 
-static char opts_next_char( stream_ctx_t* ctx ) {
-    char current = EOF;
-    ctx->current = EOF;
+/* Relationship Rules
+ *****************************************************************************/
+/* Every rule is a popcount over the options that were given, masked by the
+ * options the rule applies to. Names are only looked up to report errors. */
+static void opts_check_rules( stream_ctx_t* stream ) {
+    const schema_t* schema = stream->schema;
+    size_t words = OPT_FLAG_WORDS(schema->count), i, w;
+    char msg[OPT_NAME_MAX + 64], names[OPT_NAME_MAX];
+    for (i = 0; i < schema->num_rules; i++) {
+        const rule_t* rule   = &schema->rules[i];
+        const uint64_t* mask = &schema->rule_masks[i * words];
+        const char* holder   = NULL;
+        size_t count = 0, skip;
+        if (OPT_MAX_CFGS != rule->holder) {
+            uint64_t bit = (uint64_t)1 << (rule->holder % 64);
+            holder = schema->options[rule->holder].name;
+            if (0 == (opts_given(stream, rule->holder / 64) & bit))
+                continue;
+        }
+        for (w = 0; w < words; w++)
+            count += (size_t)__builtin_popcountll(opts_given(stream, w) & mask[w]);
 
-    if (ctx->line_idx < ctx->arg_count) {
-        ctx->col_idx++;
-        if (ctx->line_idx < ctx->arg_count) {
-            char temp = ctx->arg_vect[ ctx->line_idx ][ ctx->col_idx ];
-            if (temp == '\0') {
-                ctx->col_idx = -1;
-                ctx->line_idx++;
-                current = ' ';
-                ctx->current = current;
+        if ((0 == count) &&
+            ((OPTS_REQUIRES == rule->kind) || (OPTS_EXACTLY_ONE == rule->kind))) {
+            opts_rule_names(schema, mask, names, sizeof(names));
+            if (NULL != holder) {
+                snprintf(msg, sizeof(msg), "Requires option '%s'", names);
+                opts_report(stream, msg, holder, strlen(holder));
             } else {
-                temp = (temp == '=') ? ' ' : temp;
-                current = temp;
-                ctx->current = current;
+                opts_report(stream, "Expected one of these options, none received",
+                            names, strlen(names));
             }
+            continue;
+        } else if ((OPTS_CONFLICTS == rule->kind) && (NULL != holder)) {
+            skip = 0;
+        } else if ((count > 1) && (OPTS_REQUIRES != rule->kind)) {
+            /* Within a group the first option defined wins and each of the
+             * others conflicts with it */
+            for (w = 0; 0 == (opts_given(stream, w) & mask[w]); w++)
+                ;
+            skip   = w * 64 + (size_t)__builtin_ctzll(opts_given(stream, w) & mask[w]) + 1;
+            holder = schema->options[skip - 1].name;
+        } else {
+            continue;
+        }
+        if (0 != count) {
+            snprintf(msg, sizeof(msg), "Conflicts with option '%s'", holder);
+            for (w = 0; w < words; w++) {
+                uint64_t bits = opts_given(stream, w) & mask[w];
+                while (0 != bits) {
+                    size_t cfg       = w * 64 + (size_t)__builtin_ctzll(bits);
+                    const char* name = schema->options[cfg].name;
+                    bits &= bits - 1;
+                    if (cfg >= skip)
+                        opts_report(stream, msg, name, strlen(name));
+                }
+            }
+        }
+    }
+}
+
+/* The options given to an overlay are checked together with those of its base */
+static uint64_t opts_given( const stream_ctx_t* stream, size_t word ) {
+    const opts_ctx_t* ctx = stream->ctx;
+    uint64_t given = stream->present[word];
+    if ((NULL != ctx) && (NULL != ctx->base))
+        given |= ctx->base->present[word];
+    return given;
+}
+
+/* Joins the names of the options in the mask with '|', truncating if they do
+ * not all fit */
+static void opts_rule_names( const schema_t* schema, const uint64_t* mask, char* buf,
+                             size_t size ) {
+    size_t words = OPT_FLAG_WORDS(schema->count), w, used = 0;
+    buf[0] = '\0';
+    for (w = 0; w < words; w++) {
+        uint64_t bits = mask[w];
+        while ((0 != bits) && (used < size)) {
+            size_t cfg = w * 64 + (size_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+            used += (size_t)snprintf(&buf[used], size - used, "%s%s",
+                                     (0 == used) ? "" : "|", schema->options[cfg].name);
         }
     }
+}
 
-    return current;
+/* Memory Management
+ *****************************************************************************/
+/* Resizes the array whose address is given from old_cap to cap elements. The
+ * array is left as it was if there is no room. */
+static bool opts_grow( arena_t* arena, void* array, size_t old_cap, size_t cap,
+                       size_t size ) {
+    void* block;
+    memcpy(&block, array, sizeof(void*));
+    block = opts_alloc( arena, block, old_cap * size, cap * size );
+    if (NULL == block)
+        return false;
+    memcpy(array, &block, sizeof(void*));
+    return true;
 }
 
-static char* opts_append_char( char* str, char ch ) {
-    unsigned int new_size = strlen( str ) + 2;
-    str = (char*)realloc( str, new_size );
-    str[ new_size - 2 ] = ch;
-    str[ new_size - 1 ] = '\0';
-    return str;
+/* Works like realloc, taking the storage from the arena if there is one. Only
+ * the most recent block of an arena can grow in place, anything else is
+ * copied to a new block and the old one abandoned until the arena is reset. */
+static void* opts_alloc( arena_t* arena, void* old, size_t old_size, size_t size ) {
+    char* block;
+    if ((NULL == arena) || (NULL == arena->base)) {
+        METRIC_COUNT(allocations, 1);
+        return realloc(old, size);
+    }
+    size = OPT_ALIGN_UP(size);
+    /* The most recent block can grow in place */
+    if ((NULL != old) &&
+        ((char*)old + OPT_ALIGN_UP(old_size) == arena->base + arena->top)) {
+        size_t start = (size_t)((char*)old - arena->base);
+        if (size > arena->size - start)
+            return NULL;
+        arena->top = start + size;
+        return old;
+    }
+    if (size > arena->size - arena->top)
+        return NULL;
+    block = arena->base + arena->top;
+    arena->top += size;
+    if (NULL != old)
+        memcpy(block, old, old_size);
+    return block;
 }
 
-static void opts_add_option(char* name, char* tag, char* arg) {
-    option_t* option = (option_t*)malloc(sizeof(option_t));
-    option->name     = name;
-    option->tag      = strclone(tag);
-    option->value    = (NULL == arg) ? name : arg;
-    entry_t* entry   = (entry_t*)malloc(sizeof(entry_t));
-    entry->value     = (void*)option;
-    entry->next      = Options;
-    Options          = entry;
+/* Queries may run on several threads at once, so they claim their storage
+ * from the arena with a compare and swap */
+static void* opts_alloc_shared( arena_t* arena, size_t size ) {
+    size_t top;
+    if (NULL == arena->base) {
+        METRIC_COUNT(allocations, 1);
+        return malloc(size);
+    }
+    size = OPT_ALIGN_UP(size);
+    top  = __atomic_load_n(&arena->top, __ATOMIC_RELAXED);
+    do {
+        if (size > arena->size - top)
+            return NULL;
+    } while (!__atomic_compare_exchange_n(&arena->top, &top, top + size, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return arena->base + top;
 }
 
-static void opts_add_argument(char* arg_val) {
-    entry_t* entry = (entry_t*)malloc(sizeof(entry_t));
-    entry->value   = (void*)arg_val;
-    entry->next    = Arguments;
-    Arguments      = entry;
+/* Blocks of an arena are only given back all at once */
+static void opts_release( arena_t* arena, void* block ) {
+    if ((NULL == arena) || (NULL == arena->base))
+        free(block);
 }
 
-/* Parser Cleanup
+/* Value Interning
  *****************************************************************************/
-void opts_reset(void) {
-    while (Options != NULL) {
-        entry_t* entry = Options;
-        option_t* opt  = (option_t*)entry->value;
-        Options = entry->next;
-        free(opt->name);
-        free(opt->tag);
-        if(opt->name != opt->value)
-            free(opt->value);
-        free(opt);
-        free(entry);
+opts_intern_t* opts_intern_new(size_t size) {
+    opts_intern_t* table = (opts_intern_t*)malloc(sizeof(opts_intern_t));
+    size_t buckets = 16;
+    if (0 == size)
+        size = 4096;
+    while (buckets < size)
+        buckets *= 2;
+    if (NULL == table)
+        return NULL;
+    table->mask    = buckets - 1;
+    table->buckets = (intern_node_t**)calloc(buckets, sizeof(intern_node_t*));
+    if (NULL == table->buckets) {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+void opts_intern_free(opts_intern_t* table) {
+    size_t i;
+    if (NULL == table)
+        return;
+    for (i = 0; i <= table->mask; i++) {
+        while (NULL != table->buckets[i]) {
+            intern_node_t* node = table->buckets[i];
+            table->buckets[i] = node->next;
+            free(node);
+        }
+    }
+    free(table->buckets);
+    free(table);
+}
+
+/* A lookup that loses the race to add a node only has to search the nodes
+ * that were added ahead of it before trying again */
+const char* opts_intern(opts_intern_t* table, const char* str) {
+    size_t length = strlen(str), hash = opts_hash(str, length);
+    intern_node_t** bucket = &table->buckets[hash & table->mask];
+    intern_node_t* head = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+    intern_node_t* searched = NULL;
+    intern_node_t* node = NULL;
+    for (;;) {
+        intern_node_t* curr;
+        for (curr = head; curr != searched; curr = curr->next) {
+            if ((curr->hash == hash) && (curr->length == length) &&
+                (0 == memcmp(curr->text, str, length))) {
+                free(node);
+                return curr->text;
+            }
+        }
+        if (NULL == node) {
+            METRIC_COUNT(allocations, 1);
+            node = (intern_node_t*)malloc(sizeof(intern_node_t) + length + 1);
+            if (NULL == node)
+                return NULL;
+            node->hash   = hash;
+            node->length = length;
+            memcpy(node->text, str, length + 1);
+        }
+        node->next = head;
+        searched   = head;
+        if (__atomic_compare_exchange_n(bucket, &head, node, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+            return node->text;
+    }
+}
+
+void opts_ctx_use_intern(opts_ctx_t* ctx, opts_intern_t* table) {
+    ctx->intern = table;
+}
+
+/* Schema Lookup Tables
+ *****************************************************************************/
+/* Returns false if there was no room for the tables, in which case whatever
+ * was built must still be freed */
+static bool opts_compile_schema( schema_t* schema, opts_cfg_t* opts, arena_t* arena ) {
+    size_t i, size = 2, entries;
+    schema->options = opts;
+    schema->count   = 0;
+    while ((NULL != opts[schema->count].name) && (schema->count < OPT_MAX_CFGS-1))
+        schema->count++;
+    while (size < 2 * schema->count)
+        size <<= 1;
+    entries           = schema->count + 1;
+    schema->mask      = size - 1;
+    schema->lengths   = (size_t*)opts_alloc(arena, NULL, 0, entries * sizeof(size_t));
+    schema->tags      = (uint16_t*)opts_alloc(arena, NULL, 0, entries * sizeof(uint16_t));
+    schema->names     = (uint16_t*)opts_alloc(arena, NULL, 0, size * sizeof(uint16_t));
+    schema->tag_names = (uint16_t*)opts_alloc(arena, NULL, 0, size * sizeof(uint16_t));
+    schema->enums     = (perfect_t*)opts_alloc(arena, NULL, 0, entries * sizeof(perfect_t));
+    schema->flag_bits = (uint16_t*)opts_alloc(arena, NULL, 0, entries * sizeof(uint16_t));
+    schema->logical   = (uint16_t*)opts_alloc(arena, NULL, 0, entries * sizeof(uint16_t));
+    memset(schema->shorts, 0, sizeof(schema->shorts));
+    schema->num_flags   = 0;
+    schema->constrained = false;
+    schema->num_rules   = 0;
+    schema->rules       = NULL;
+    schema->rule_masks  = NULL;
+    if ((NULL == schema->lengths) || (NULL == schema->tags) || (NULL == schema->names) ||
+        (NULL == schema->tag_names) || (NULL == schema->enums) ||
+        (NULL == schema->flag_bits) || (NULL == schema->logical)) {
+        /* None of the enum tables have been built, or even cleared */
+        schema->count = 0;
+        return false;
+    }
+    memset(schema->names, 0, size * sizeof(uint16_t));
+    memset(schema->tag_names, 0, size * sizeof(uint16_t));
+    memset(schema->enums, 0, (schema->count + 1) * sizeof(perfect_t));
+
+    for (i = 0; i < schema->count; i++) {
+        size_t slot;
+        schema->lengths[i] = strlen(opts[i].name);
+        /* Short names index straight into a table. Long names are hashed. The
+         * first definition of a name wins, just like a linear search would */
+        if (1 == schema->lengths[i]) {
+            if (0 == schema->shorts[(unsigned char)opts[i].name[0]])
+                schema->shorts[(unsigned char)opts[i].name[0]] = i+1;
+        } else {
+            slot = opts_hash(opts[i].name, schema->lengths[i]) & schema->mask;
+            while (0 != schema->names[slot])
+                slot = (slot + 1) & schema->mask;
+            schema->names[slot] = i+1;
+        }
+        schema->logical[i]   = i;
+        schema->flag_bits[i] = OPT_MAX_CFGS;
+        schema->tags[i]      = 0;
+        /* The rest of an alias comes from the option it names */
+        if (NULL != opts[i].alias)
+            continue;
+        /* Options sharing a tag are given the index of the first of them */
+        schema->tags[i] = opts_find_tag(schema, opts[i].tag);
+        if ((0 == schema->tags[i]) && (NULL != opts[i].tag)) {
+            slot = opts_hash(opts[i].tag, strlen(opts[i].tag)) & schema->mask;
+            while (0 != schema->tag_names[slot])
+                slot = (slot + 1) & schema->mask;
+            schema->tag_names[slot] = i+1;
+            schema->tags[i] = i+1;
+        }
+        /* Options without arguments are numbered in the order they appear */
+        if (!opts[i].has_arg)
+            schema->flag_bits[i] = schema->num_flags++;
+        /* Build the lookup tables for any enumerated values */
+        if (NULL != opts[i].constraint) {
+            schema->constrained = true;
+            if ((OPTS_ENUM == opts[i].constraint->kind) &&
+                !opts_compile_enum( &schema->enums[i], opts[i].constraint->values, arena ))
+                return false;
+        }
+    }
+    /* Every name of a logical option resolves to the definition that holds
+     * it, so the parse and the queries only ever see that one */
+    for (i = 0; i < schema->count; i++) {
+        const char* alias = opts[i].alias;
+        size_t target = 0;
+        if (NULL != alias)
+            target = opts_find_config(schema, alias, strlen(alias));
+        if (0 != target)
+            schema->logical[i] = target - 1;
+    }
+    return opts_compile_rules( schema, arena );
+}
+
+static void opts_free_schema( schema_t* schema, arena_t* arena ) {
+    size_t i;
+    for (i = 0; (NULL != schema->enums) && (i < schema->count); i++)
+        opts_release(arena, schema->enums[i].slots);
+    opts_release(arena, schema->enums);
+    opts_release(arena, schema->flag_bits);
+    opts_release(arena, schema->logical);
+    opts_release(arena, schema->rules);
+    opts_release(arena, schema->rule_masks);
+    opts_release(arena, schema->lengths);
+    opts_release(arena, schema->tags);
+    opts_release(arena, schema->names);
+    opts_release(arena, schema->tag_names);
+    memset(schema, 0, sizeof(schema_t));
+}
+
+/* Each rule is compiled to a mask over the definitions so that checking it
+ * takes a few ANDs of the set of options that were given */
+static bool opts_compile_rules( schema_t* schema, arena_t* arena ) {
+    size_t i, j, cfg, masks, words = OPT_FLAG_WORDS(schema->count);
+    rule_t* rule;
+    uint64_t* mask;
+    for (i = 0; i <= schema->count; i++) {
+        const opts_rule_t* list = opts_rule_list(schema, i);
+        for (j = 0; (NULL != list) && (0 != list[j].kind); j++)
+            schema->num_rules++;
+    }
+    if (0 == schema->num_rules)
+        return true;
+    masks = schema->num_rules * words * sizeof(uint64_t);
+    schema->rules      = (rule_t*)opts_alloc(arena, NULL, 0,
+                                             schema->num_rules * sizeof(rule_t));
+    schema->rule_masks = (uint64_t*)opts_alloc(arena, NULL, 0, masks);
+    if ((NULL == schema->rules) || (NULL == schema->rule_masks))
+        return false;
+    memset(schema->rule_masks, 0, masks);
+
+    rule = schema->rules;
+    mask = schema->rule_masks;
+    for (i = 0; i <= schema->count; i++) {
+        const opts_rule_t* list = opts_rule_list(schema, i);
+        for (j = 0; (NULL != list) && (0 != list[j].kind); j++, rule++, mask += words) {
+            const opts_rule_t* decl = &list[j];
+            size_t name = 0;
+            size_t tag  = opts_find_tag(schema, decl->tag);
+            bool pair   = (OPTS_REQUIRES == decl->kind) || (OPTS_CONFLICTS == decl->kind);
+            rule->holder = (i == schema->count) ? OPT_MAX_CFGS : i;
+            rule->kind   = decl->kind;
+            rule->decl   = decl;
+            if (NULL != decl->name)
+                name = opts_find_config(schema, decl->name, strlen(decl->name));
+            /* A name or tag that is not defined matches nothing */
+            if (((NULL != decl->name) && (0 == name)) ||
+                ((NULL != decl->tag) && (0 == tag)))
+                continue;
+            for (cfg = 0; cfg < schema->count; cfg++) {
+                if ((schema->logical[cfg] == cfg) &&
+                    ((0 == name) || (name == cfg+1)) &&
+                    ((0 == tag) || (tag == schema->tags[cfg])) &&
+                    !(pair && (rule->holder == cfg)))
+                    mask[cfg / 64] |= (uint64_t)1 << (cfg % 64);
+            }
+        }
+    }
+    return true;
+}
+
+/* Aliases have no rules of their own, and the entry ending the definitions
+ * holds the rules of the whole table */
+static const opts_rule_t* opts_rule_list( const schema_t* schema, size_t cfg ) {
+    const opts_cfg_t* config = &schema->options[cfg];
+    return ((cfg == schema->count) || (NULL == config->alias)) ? config->rules : NULL;
+}
+
+static size_t opts_find_config( const schema_t* schema, const char* name, size_t length ) {
+    size_t slot, index = 0;
+    METRIC_COUNT(lookups, 1);
+    if (1 == length) {
+        index = schema->shorts[(unsigned char)name[0]];
+    } else if (NULL != schema->names) {
+        slot = opts_hash(name, length) & schema->mask;
+        while (0 != (index = schema->names[slot])) {
+            METRIC_COUNT(comparisons, 1);
+            if ((schema->lengths[index-1] == length) &&
+                (0 == memcmp(schema->options[index-1].name, name, length)))
+                break;
+            slot = (slot + 1) & schema->mask;
+        }
     }
+    return (0 == index) ? 0 : (size_t)schema->logical[index-1] + 1;
+}
+
+static size_t opts_find_tag( const schema_t* schema, const char* tag ) {
+    size_t slot, index = 0;
+    if ((NULL != tag) && (NULL != schema->tag_names)) {
+        METRIC_COUNT(lookups, 1);
+        slot = opts_hash(tag, strlen(tag)) & schema->mask;
+        while (0 != (index = schema->tag_names[slot])) {
+            METRIC_COUNT(comparisons, 1);
+            if (0 == strcmp(schema->options[index-1].tag, tag))
+                break;
+            slot = (slot + 1) & schema->mask;
+        }
+    }
+    return index;
+}
+
+static size_t opts_hash( const char* str, size_t length ) {
+    size_t hash = 2166136261u;
+    while (length--)
+        hash = (hash ^ (unsigned char)*str++) * 16777619u;
+    return hash;
+}
 
-    while (Arguments != NULL) {
-        entry_t* entry = Arguments;
-        char* arg  = (char*)entry->value;
-        Arguments = entry->next;
-        free(arg);
-        free(entry);
+/* Enumerated values are placed in a table using a seeded hash. Seeds are tried
+ * until one is found that gives every value its own slot, so a lookup is a
+ * single hash followed by a single string comparison. */
+static bool opts_compile_enum( perfect_t* perfect, const char** values, arena_t* arena ) {
+    size_t i, count = 0, size = 2;
+    while (NULL != values[count])
+        count++;
+    while (size < 2 * count)
+        size <<= 1;
+    for (;; size <<= 1) {
+        size_t old = (NULL != perfect->slots) ? size / 2 : 0;
+        if (!opts_grow(arena, &perfect->slots, old, size, sizeof(uint16_t)))
+            return false;
+        perfect->mask = size - 1;
+        for (perfect->seed = 0; perfect->seed < 64; perfect->seed++) {
+            memset(perfect->slots, 0, size * sizeof(uint16_t));
+            for (i = 0; i < count; i++) {
+                size_t slot = opts_seeded_hash(values[i], strlen(values[i]), perfect->seed);
+                slot &= perfect->mask;
+                if (0 == perfect->slots[slot])
+                    perfect->slots[slot] = i+1;
+                else if (0 != strcmp(values[perfect->slots[slot]-1], values[i]))
+                    break;
+            }
+            if (i == count)
+                return true;
+        }
     }
 }
 
-/* Utility Functions
+static long opts_find_enum( const perfect_t* perfect, const char** values,
+                            const char* value ) {
+    size_t slot  = opts_seeded_hash(value, strlen(value), perfect->seed) & perfect->mask;
+    size_t index = perfect->slots[slot];
+    METRIC_COUNT(lookups, 1);
+    METRIC_COUNT(comparisons, (0 != index) ? 1 : 0);
+    return ((0 != index) && (0 == strcmp(values[index-1], value))) ? (long)index-1 : -1;
+}
+
+static uint32_t opts_seeded_hash( const char* str, size_t length, uint32_t seed ) {
+    uint32_t hash = 2166136261u ^ (seed * 0x9E3779B9u);
+    while (length--)
+        hash = (hash ^ (unsigned char)*str++) * 16777619u;
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+static unsigned int opts_char_class( char ch ) {
+    if (('0' <= ch) && (ch <= '9'))
+        return OPTS_DIGIT;
+    else if (('a' <= ch) && (ch <= 'z'))
+        return OPTS_LOWER;
+    else if (('A' <= ch) && (ch <= 'Z'))
+        return OPTS_UPPER;
+    else if (('-' == ch) || ('_' == ch))
+        return OPTS_DASH;
+    else if ('.' == ch)
+        return OPTS_DOT;
+    else if ('/' == ch)
+        return OPTS_SLASH;
+    else
+        return 0;
+}
+
+/* Parser Cleanup
  *****************************************************************************/
-static char* strclone(const char* p_old) {
-    size_t length = strlen(p_old);
-    char* p_str = (char*)malloc(length+1);
-    memcpy(p_str, p_old, length);
-    p_str[length] = '\0';
-    return p_str;
+opts_ctx_t* opts_ctx_new(void) {
+    METRIC_COUNT(allocations, 1);
+    return (opts_ctx_t*)calloc(1, sizeof(opts_ctx_t));
+}
+
+opts_ctx_t* opts_ctx_init(void* buf, size_t size) {
+    /* The context itself is the first thing placed in the buffer */
+    uintptr_t addr = ((uintptr_t)buf + OPT_ALIGN - 1) & ~(uintptr_t)(OPT_ALIGN - 1);
+    size_t used = (size_t)(addr - (uintptr_t)buf) + OPT_ALIGN_UP(sizeof(opts_ctx_t));
+    opts_ctx_t* ctx = (opts_ctx_t*)addr;
+    if ((NULL == buf) || (size < used))
+        return NULL;
+    memset(ctx, 0, sizeof(opts_ctx_t));
+    ctx->arena.base = (char*)buf + used;
+    ctx->arena.size = size - used;
+    return ctx;
+}
+
+static void opts_free_memos( opts_ctx_t* ctx ) {
+    size_t i;
+    for (i = 0; i < OPT_MEMO_SLOTS; i++) {
+        while (NULL != ctx->memos[i]) {
+            memo_t* memo = ctx->memos[i];
+            ctx->memos[i] = memo->next;
+            opts_release(&ctx->arena, memo);
+        }
+    }
+    /* Hand back everything claimed by queries on the previous result */
+    ctx->arena.top = ctx->arena.mark;
+}
+
+static void opts_ctx_clear(opts_ctx_t* ctx) {
+    arena_t arena = ctx->arena;
+    opts_intern_t* intern = ctx->intern;
+    opts_free_memos( ctx );
+    opts_release(&arena, ctx->elems);
+    opts_release(&arena, ctx->opt_cfgs);
+    opts_release(&arena, ctx->opt_argvs);
+    opts_release(&arena, ctx->opt_offsets);
+    opts_release(&arena, ctx->opt_lengths);
+    opts_release(&arena, ctx->opt_ordinals);
+    opts_release(&arena, (void*)ctx->opt_values);
+    opts_release(&arena, ctx->opt_last);
+    opts_release(&arena, ctx->flags);
+    opts_release(&arena, ctx->present);
+    opts_release(&arena, ctx->span_elems);
+    opts_release(&arena, ctx->span_offsets);
+    opts_release(&arena, ctx->span_lengths);
+    opts_release(&arena, ctx->span_keys);
+    opts_release(&arena, ctx->span_next);
+    opts_release(&arena, ctx->list_heads);
+    opts_release(&arena, ctx->list_tails);
+    opts_release(&arena, ctx->arg_argvs);
+    if (NULL == ctx->base)
+        opts_free_schema( &ctx->schema, &arena );
+    memset(ctx, 0, sizeof(opts_ctx_t));
+    /* An arena keeps its storage but is emptied */
+    ctx->arena.base = arena.base;
+    ctx->arena.size = arena.size;
+    ctx->intern     = intern;
+}
+
+void opts_ctx_free(opts_ctx_t* ctx) {
+    /* A context in caller storage is freed along with that storage */
+    if ((NULL != ctx) && (NULL == ctx->arena.base)) {
+        opts_ctx_clear(ctx);
+        free(ctx);
+    }
+}
+
+opts_ctx_t* opts_overlay(const opts_ctx_t* base) {
+    opts_ctx_t* ctx;
+    size_t count = base->schema.count + 1;
+    size_t flags = OPT_FLAG_WORDS(base->schema.num_flags);
+    size_t words = OPT_FLAG_WORDS(base->schema.count);
+    if ((NULL == base->schema.options) || (NULL != base->base) ||
+        (NULL == (ctx = opts_ctx_new())))
+        return NULL;
+    ctx->base   = base;
+    ctx->schema = base->schema;
+    ctx->intern = base->intern;
+    if (!opts_grow(NULL, &ctx->opt_last, 0, count, sizeof(uint32_t)) ||
+        !opts_grow(NULL, &ctx->flags, 0, flags, sizeof(uint64_t)) ||
+        !opts_grow(NULL, &ctx->present, 0, words, sizeof(uint64_t)) ||
+        !opts_grow(NULL, &ctx->list_heads, 0, count, sizeof(uint32_t)) ||
+        !opts_grow(NULL, &ctx->list_tails, 0, count, sizeof(uint32_t))) {
+        opts_ctx_free(ctx);
+        return NULL;
+    }
+    memset(ctx->opt_last, 0, count * sizeof(uint32_t));
+    memset(ctx->list_heads, 0, count * sizeof(uint32_t));
+    memset(ctx->present, 0, words * sizeof(uint64_t));
+    memcpy(ctx->flags, base->flags, flags * sizeof(uint64_t));
+    return ctx;
+}
+
+/* The flags of the base are set in an overlay whether or not it overrides them */
+static void opts_merge_flags( opts_ctx_t* ctx ) {
+    size_t word;
+    for (word = 0; word < OPT_FLAG_WORDS(ctx->schema.num_flags); word++)
+        ctx->flags[word] |= ctx->base->flags[word];
+}
+
+void opts_reset(void) {
+    opts_ctx_clear(&Context);
 }
 
 /* Query Functions
  *****************************************************************************/
-static option_t* find_option(const char* name, const char* tag) {
-    option_t* p_opt = NULL;
-    entry_t* current = Options;
-    while (current != NULL) {
-        option_t* curr_opt = (option_t*)current->value;
-        if (((NULL == name) || (0 == strcmp(name, curr_opt->name))) &&
-            ((NULL == tag)  || (0 == strcmp(tag,  curr_opt->tag)))) {
-            p_opt = curr_opt;
+static query_t opts_query(const schema_t* schema, const char* name, const char* tag) {
+    query_t query;
+    query.name  = (NULL == name) ? 0 : opts_find_config(schema, name, strlen(name));
+    query.tag   = opts_find_tag(schema, tag);
+    query.valid = ((NULL == name) || (0 != query.name)) &&
+                  ((NULL == tag)  || (0 != query.tag));
+    return query;
+}
+
+static bool opts_matches_cfg(const schema_t* schema, const query_t* query, uint16_t cfg) {
+    return ((0 == query->name) || (query->name == (size_t)cfg+1)) &&
+           ((0 == query->tag)  || (query->tag  == schema->tags[cfg]));
+}
+
+static bool opts_matches(const opts_ctx_t* ctx, const query_t* query, size_t opt) {
+    return opts_matches_cfg(&ctx->schema, query, ctx->opt_cfgs[opt]);
+}
+
+static const char* opts_value(const opts_ctx_t* ctx, size_t opt) {
+    uint32_t offset = ctx->opt_offsets[opt];
+    if ((NULL != ctx->opt_values) && (NULL != ctx->opt_values[opt]))
+        return ctx->opt_values[opt];
+    else if (OPT_NO_VALUE == offset)
+        return ctx->schema.options[ctx->opt_cfgs[opt]].name;
+    else if (offset & OPT_NEXT_ARG)
+        return opts_element(ctx, ctx->opt_argvs[opt] + 1) + (offset & ~OPT_NEXT_ARG);
+    else
+        return opts_element(ctx, ctx->opt_argvs[opt]) + offset;
+}
+
+static long opts_ordinal(const opts_ctx_t* ctx, size_t opt) {
+    return (ctx->schema.constrained) ? ctx->opt_ordinals[opt] : -1;
+}
+
+/* A handle packs the name and tag of a query into 16 bits each. Both are the
+ * index of a definition plus one, or zero to match anything. The handle of a
+ * name or tag that does not exist has neither, so it matches nothing. */
+static query_t opts_handle_query(opts_handle_t handle) {
+    query_t query;
+    query.name  = handle & 0xFFFFu;
+    query.tag   = handle >> 16;
+    query.valid = (OPTS_NO_HANDLE != handle);
+    return query;
+}
+
+static size_t find_option(const opts_ctx_t* ctx, const query_t* query) {
+    size_t opt = (query->valid) ? ctx->num_opts : 0;
+    uint16_t cfg = (uint16_t)(query->name - 1);
+    /* A single valued option always knows where its last occurrence is */
+    if ((opt > 0) && (0 != query->name) && (query->name <= ctx->schema.count) &&
+        (0 == query->tag) && !ctx->schema.options[cfg].multi &&
+        ('\0' == ctx->schema.options[cfg].delim))
+        return ctx->opt_last[cfg];
+    /* The most recently parsed option wins, so search from the back */
+    while ((opt > 0) && !opts_matches(ctx, query, opt-1))
+        opt--;
+    return opt;
+}
+
+/* An overlay answers from its own options first. If it has none that match,
+ * none of the matching options of its base can be hidden. */
+static const opts_ctx_t* find_owner(const opts_ctx_t* ctx, const query_t* query,
+                                     size_t* opt) {
+    *opt = find_option(ctx, query);
+    if ((0 == *opt) && (NULL != ctx->base)) {
+        ctx  = ctx->base;
+        *opt = find_option(ctx, query);
+    }
+    return ctx;
+}
+
+/* Whether an option of the base of an overlay is overridden by it */
+static bool opts_hidden( const opts_ctx_t* ctx, uint16_t cfg ) {
+    return 0 != (ctx->present[cfg / 64] & ((uint64_t)1 << (cfg % 64)));
+}
+
+opts_handle_t opts_ctx_handle(const opts_ctx_t* ctx, const char* name, const char* tag) {
+    METRIC_START(start);
+    query_t query = opts_query(&ctx->schema, name, tag);
+    METRIC_STOP(query_ns, start);
+    return (query.valid) ? (opts_handle_t)((query.tag << 16) | query.name) : OPTS_NO_HANDLE;
+}
+
+bool opts_ctx_is_set(const opts_ctx_t* ctx, const char* name, const char* tag) {
+    return opts_ctx_is_set_h(ctx, opts_ctx_handle(ctx, name, tag));
+}
+
+const char* opts_ctx_get_value(const opts_ctx_t* ctx, const char* name, const char* tag) {
+    return opts_ctx_get_value_h(ctx, opts_ctx_handle(ctx, name, tag));
+}
+
+long opts_ctx_get_ordinal(const opts_ctx_t* ctx, const char* name, const char* tag) {
+    return opts_ctx_get_ordinal_h(ctx, opts_ctx_handle(ctx, name, tag));
+}
+
+bool opts_ctx_equal(const opts_ctx_t* ctx, const char* name, const char* tag,
+                    const char* value) {
+    return opts_ctx_equal_h(ctx, opts_ctx_handle(ctx, name, tag), value);
+}
+
+const char** opts_ctx_select(const opts_ctx_t* ctx, const char* name, const char* tag) {
+    return opts_ctx_select_h(ctx, opts_ctx_handle(ctx, name, tag));
+}
+
+bool opts_ctx_is_set_h(const opts_ctx_t* ctx, opts_handle_t handle) {
+    METRIC_START(start);
+    query_t query = opts_handle_query(handle);
+    size_t opt;
+    bool set = (NULL != find_owner(ctx, &query, &opt)) && (0 != opt);
+    METRIC_COUNT(queries.is_set, 1);
+    METRIC_STOP(query_ns, start);
+    return set;
+}
+
+const char* opts_ctx_get_value_h(const opts_ctx_t* ctx, opts_handle_t handle) {
+    METRIC_START(start);
+    query_t query = opts_handle_query(handle);
+    size_t opt;
+    const opts_ctx_t* owner = find_owner(ctx, &query, &opt);
+    const char* value = (0 == opt) ? NULL : opts_value(owner, opt-1);
+    METRIC_COUNT(queries.get_value, 1);
+    METRIC_STOP(query_ns, start);
+    return value;
+}
+
+long opts_ctx_get_ordinal_h(const opts_ctx_t* ctx, opts_handle_t handle) {
+    METRIC_START(start);
+    query_t query = opts_handle_query(handle);
+    size_t opt;
+    const opts_ctx_t* owner = find_owner(ctx, &query, &opt);
+    long ordinal = (0 == opt) ? -1 : opts_ordinal(owner, opt-1);
+    METRIC_COUNT(queries.get_ordinal, 1);
+    METRIC_STOP(query_ns, start);
+    return ordinal;
+}
+
+bool opts_ctx_equal_h(const opts_ctx_t* ctx, opts_handle_t handle, const char* value) {
+    METRIC_START(start);
+    query_t query = opts_handle_query(handle);
+    size_t opt;
+    const opts_ctx_t* owner = find_owner(ctx, &query, &opt);
+    const char* found = (0 == opt) ? NULL : opts_value(owner, opt-1);
+    /* A value interned in the same table matches on its pointer alone */
+    bool equal = (NULL != found) && ((found == value) || (0 == strcmp(value, found)));
+    METRIC_COUNT(queries.equal, 1);
+    METRIC_STOP(query_ns, start);
+    return equal;
+}
+
+static memo_t* opts_find_memo(memo_t* memo, const query_t* query) {
+    while ((NULL != memo) && ((memo->name != query->name) || (memo->tag != query->tag)))
+        memo = memo->next;
+    return memo;
+}
+
+static memo_t* opts_build_memo(const opts_ctx_t* ctx, const query_t* query) {
+    size_t opt, count = 0, index = 0;
+    const opts_ctx_t* base = ctx->base;
+    memo_t* memo;
+
+    /* Size the array up front so it is only allocated once */
+    for (opt = 0; query->valid && (opt < ctx->num_opts); opt++)
+        count += opts_matches(ctx, query, opt);
+    for (opt = 0; query->valid && (NULL != base) && (opt < base->num_opts); opt++)
+        count += opts_matches(base, query, opt) && !opts_hidden(ctx, base->opt_cfgs[opt]);
+    memo = (memo_t*)opts_alloc_shared((arena_t*)&ctx->arena,
+                                      sizeof(memo_t) + (count+1) * sizeof(const char*));
+    if (NULL == memo)
+        return NULL;
+    memo->name = query->name;
+    memo->tag  = query->tag;
+
+    /* Most recently parsed options come first, and those of an overlay come
+     * before any of its base */
+    for (opt = ctx->num_opts; (index < count) && (opt > 0); opt--)
+        if (opts_matches(ctx, query, opt-1))
+            memo->items[index++] = opts_value(ctx, opt-1);
+    for (opt = (NULL == base) ? 0 : base->num_opts; (index < count) && (opt > 0); opt--)
+        if (opts_matches(base, query, opt-1) && !opts_hidden(ctx, base->opt_cfgs[opt-1]))
+            memo->items[index++] = opts_value(base, opt-1);
+    memo->items[index] = NULL;
+    return memo;
+}
+
+/* Selections are built once per handle and kept until the next parse.
+ * The result is otherwise read only, so a selection is published with a
+ * compare and swap to let threads sharing a context select concurrently. A
+ * thread that loses the race to publish the same selection uses the winner's
+ * and discards its own. */
+const char** opts_ctx_select_h(const opts_ctx_t* ctx, opts_handle_t handle) {
+    METRIC_START(start);
+    query_t query = opts_handle_query(handle);
+    size_t hash   = (query.name * 31 + query.tag) & (OPT_MEMO_SLOTS-1);
+    memo_t** slot = (memo_t**)&ctx->memos[hash];
+    memo_t* head  = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    memo_t* memo  = NULL;
+    for (;;) {
+        memo_t* found = opts_find_memo(head, &query);
+        if (NULL != found) {
+            opts_release((arena_t*)&ctx->arena, memo);
+            memo = found;
             break;
         }
-        current = current->next;
+        if ((NULL == memo) && (NULL == (memo = opts_build_memo(ctx, &query))))
+            break;
+        memo->next = head;
+        if (__atomic_compare_exchange_n(slot, &head, memo, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            break;
+    }
+    METRIC_COUNT(queries.select, 1);
+    METRIC_STOP(query_ns, start);
+    return (NULL != memo) ? memo->items : NULL;
+}
+
+const char** opts_ctx_arguments(const opts_ctx_t* ctx) {
+    METRIC_START(start);
+    size_t index;
+    if ((0 == ctx->num_args) && (NULL != ctx->base))
+        ctx = ctx->base;
+    size_t size = (ctx->num_args+1) * sizeof(const char*);
+    const char** ret = (const char**)opts_alloc_shared((arena_t*)&ctx->arena, size);
+    /* Most recently parsed arguments come first */
+    for (index = 0; (NULL != ret) && (index < ctx->num_args); index++)
+        ret[index] = opts_element(ctx, ctx->arg_argvs[ctx->num_args - index - 1]);
+    if (NULL != ret)
+        ret[index] = NULL;
+    METRIC_COUNT(queries.arguments, 1);
+    METRIC_STOP(query_ns, start);
+    return ret;
+}
+
+const char* opts_ctx_prog_name(const opts_ctx_t* ctx) {
+    return (NULL != ctx->base) ? ctx->base->prog_name : ctx->prog_name;
+}
+
+const uint64_t* opts_ctx_flags(const opts_ctx_t* ctx) {
+    return (NULL != ctx->flags) ? ctx->flags : No_Flags;
+}
+
+void opts_ctx_list_begin(const opts_ctx_t* ctx, opts_list_t* it, const char* name) {
+    size_t cfg = opts_find_config(&ctx->schema, name, strlen(name));
+    if ((0 != cfg) && (NULL != ctx->base) && !opts_hidden(ctx, (uint16_t)(cfg-1)))
+        ctx = ctx->base;
+    it->value      = NULL;
+    it->length     = 0;
+    it->key        = NULL;
+    it->key_length = 0;
+    it->ctx        = ctx;
+    it->pairs      = (0 != cfg) && ctx->schema.options[cfg-1].pairs;
+    it->span       = (0 == cfg) ? 0 : ctx->list_heads[cfg-1];
+}
+
+bool opts_list_next(opts_list_t* it) {
+    const opts_ctx_t* ctx = it->ctx;
+    size_t span = it->span;
+    const char* item;
+    uint32_t key;
+    if (0 == span--)
+        return false;
+    item = opts_element(ctx, ctx->span_elems[span]) + ctx->span_offsets[span];
+    key  = ctx->span_keys[span];
+    if (!it->pairs) {
+        it->value  = item;
+        it->length = ctx->span_lengths[span];
+    } else if (OPT_NO_VALUE == key) {
+        /* A pair without an '=' is all key and has no value */
+        it->key        = item;
+        it->key_length = ctx->span_lengths[span];
+        it->value      = NULL;
+        it->length     = 0;
+    } else {
+        it->key        = item;
+        it->key_length = key;
+        it->value      = item + key + 1;
+        it->length     = ctx->span_lengths[span] - key - 1;
+    }
+    it->span = ctx->span_next[span];
+    return true;
+}
+
+int opts_ctx_flag_bit(const opts_ctx_t* ctx, const char* name) {
+    size_t cfg = opts_find_config(&ctx->schema, name, strlen(name));
+    if ((0 == cfg) || (OPT_MAX_CFGS == ctx->schema.flag_bits[cfg-1]))
+        return -1;
+    return ctx->schema.flag_bits[cfg-1];
+}
+
+void opts_ctx_iter_begin(const opts_ctx_t* ctx, opts_iter_t* it, const char* name,
+                         const char* tag, bool args) {
+    METRIC_START(start);
+    query_t query = opts_query(&ctx->schema, name, tag);
+    it->option  = NULL;
+    it->value   = NULL;
+    it->length  = 0;
+    it->ordinal = -1;
+    it->index   = 0;
+    it->ctx     = ctx;
+    it->name    = query.name;
+    it->tag     = query.tag;
+    it->opt     = (query.valid) ? 0 : ctx->num_opts;
+    it->arg     = (args) ? 0 : ctx->num_args;
+    METRIC_COUNT(queries.iter, 1);
+    METRIC_STOP(query_ns, start);
+}
+
+bool opts_iter_next(opts_iter_t* it) {
+    METRIC_START(start);
+    const opts_ctx_t* ctx = it->ctx;
+    query_t query = { it->name, it->tag, true };
+    bool found = true;
+    while ((it->opt < ctx->num_opts) && !opts_matches(ctx, &query, it->opt))
+        it->opt++;
+    /* Both arrays are in command line order so merge them by argv index */
+    if ((it->opt < ctx->num_opts) &&
+        ((it->arg >= ctx->num_args) ||
+         (ctx->opt_argvs[it->opt] < ctx->arg_argvs[it->arg]))) {
+        uint16_t cfg = ctx->opt_cfgs[it->opt];
+        it->option  = &ctx->schema.options[cfg];
+        it->value   = opts_value(ctx, it->opt);
+        it->length  = (OPT_NO_VALUE == ctx->opt_offsets[it->opt])
+                   ? ctx->schema.lengths[cfg] : ctx->opt_lengths[it->opt];
+        it->ordinal = opts_ordinal(ctx, it->opt);
+        it->index   = ctx->opt_argvs[it->opt++];
+    } else if (it->arg < ctx->num_args) {
+        it->option  = NULL;
+        it->ordinal = -1;
+        it->index   = ctx->arg_argvs[it->arg++];
+        it->value   = opts_element(ctx, it->index);
+        it->length  = strlen(it->value);
+    } else {
+        found = false;
     }
-    return p_opt;
+    METRIC_STOP(query_ns, start);
+    return found;
 }
 
+/* Global Query Functions
+ *****************************************************************************/
 bool opts_is_set(const char* name, const char* tag) {
-    return (NULL != find_option(name,tag));
+    return opts_ctx_is_set(&Context, name, tag);
 }
 
 const char* opts_get_value(const char* name, const char* tag) {
-    option_t* p_opt = find_option(name,tag);
-    return (NULL == p_opt) ? NULL : p_opt->value;
+    return opts_ctx_get_value(&Context, name, tag);
+}
+
+long opts_get_ordinal(const char* name, const char* tag) {
+    return opts_ctx_get_ordinal(&Context, name, tag);
 }
 
 bool opts_equal(const char* name, const char* tag, const char* value) {
-    return (0 == strcmp(value, opts_get_value(name,tag)));
+    return opts_ctx_equal(&Context, name, tag, value);
 }
 
 const char** opts_select(const char* name, const char* tag) {
-    size_t index = 0;
-    const char** ret = (const char**)malloc(sizeof(const char*));
-    ret[index] = NULL;
+    return opts_ctx_select(&Context, name, tag);
+}
 
-    entry_t* current = Options;
-    while (current != NULL) {
-        option_t* curr_opt = (option_t*)current->value;
-        if (((NULL == name) || (0 == strcmp(name, curr_opt->name))) &&
-            ((NULL == tag)  || (0 == strcmp(tag,  curr_opt->tag)))) {
-            ret = (const char**)realloc(ret, (index+2)*sizeof(const char*));
-            ret[index++] = curr_opt->value;
-            ret[index]   = NULL;
-        }
-        current = current->next;
-    }
+opts_handle_t opts_handle(const char* name, const char* tag) {
+    return opts_ctx_handle(&Context, name, tag);
+}
 
-    return ret;
+bool opts_is_set_h(opts_handle_t handle) {
+    return opts_ctx_is_set_h(&Context, handle);
+}
+
+const char* opts_get_value_h(opts_handle_t handle) {
+    return opts_ctx_get_value_h(&Context, handle);
+}
+
+long opts_get_ordinal_h(opts_handle_t handle) {
+    return opts_ctx_get_ordinal_h(&Context, handle);
+}
+
+bool opts_equal_h(opts_handle_t handle, const char* value) {
+    return opts_ctx_equal_h(&Context, handle, value);
+}
+
+const char** opts_select_h(opts_handle_t handle) {
+    return opts_ctx_select_h(&Context, handle);
 }
 
 const char** opts_arguments(void) {
-    size_t index = 0;
-    const char** ret = (const char**)malloc(sizeof(const char*));
-    ret[0] = NULL;
-    entry_t* entry = Arguments;
-    while (NULL != entry) {
-        ret = (const char**)realloc(ret, (index+2)*sizeof(const char*));
-        ret[index++] = (const char*)entry->value;
-        ret[index]   = NULL;
-        entry = entry->next;
-    }
-    return ret;
+    return opts_ctx_arguments(&Context);
 }
 
 const char* opts_prog_name(void) {
-    return Program_Name;
+    return opts_ctx_prog_name(&Context);
+}
+
+const uint64_t* opts_flags(void) {
+    return opts_ctx_flags(&Context);
+}
+
+int opts_flag_bit(const char* name) {
+    return opts_ctx_flag_bit(&Context, name);
+}
+
+void opts_iter_begin(opts_iter_t* it, const char* name, const char* tag, bool args) {
+    opts_ctx_iter_begin(&Context, it, name, tag, args);
+}
+
+void opts_list_begin(opts_list_t* it, const char* name) {
+    opts_ctx_list_begin(&Context, it, name);
 }
 
 /* Help Message Printing
@@ -354,16 +2190,645 @@ static int opts_calc_padding(opts_cfg_t* opts) {
 
 void opts_print_help(FILE* ofile, opts_cfg_t* opts) {
     int padding = opts_calc_padding(opts);
-    char*  buffer  = (char*)malloc(padding+1);
     while (NULL != opts->name) {
-        if (1 == strlen(opts->name))
-            sprintf(buffer, " -%s", opts->name);
+        int width = fprintf(ofile, ('\0' == opts->name[1]) ? " -%s%s" : " --%s%s",
+                            opts->name, (opts->has_arg) ? "=ARG " : "");
+        int fill  = (width < padding) ? padding - width : 0;
+        if (NULL != opts->alias)
+            fprintf(ofile, "%*sSame as %s%s\n", fill, "",
+                    ('\0' == opts->alias[1]) ? "-" : "--", opts->alias);
         else
-            sprintf(buffer, " --%s", opts->name);
-        if (opts->has_arg) sprintf(&buffer[strlen(buffer)], "=ARG ");
-        fprintf(ofile, "%-*s%s\n", padding, buffer, opts->desc);
+            fprintf(ofile, "%*s%s\n", fill, "", opts->desc);
         opts++;
     }
-    free(buffer);
 }
 
+
+/* Shell Completion
+ *****************************************************************************/
+/* Completion runs once per keypress in a fresh process, so a single pass over
+ * the definitions costs less than building any index over them would. */
+void opts_complete(FILE* ofile, opts_cfg_t* opts, int argc, char** argv, int cursor) {
+    const char* word = ((cursor > 0) && (cursor < argc)) ? argv[cursor] : "";
+    const char* prev = ((cursor > 1) && (cursor <= argc)) ? argv[cursor-1] : NULL;
+    const char* equals;
+    opts_cfg_t* cfg;
+    int i;
+
+    /* Everything after a "--" is a positional argument */
+    for (i = 1; (i < cursor) && (i < argc); i++)
+        if (0 == strcmp(argv[i], "--"))
+            return;
+
+    if ((NULL != prev) && (0 == strcmp(prev, "=")) && (cursor > 2)) {
+        /* Bash splits "--name=value" into separate words around the '=' */
+        cfg = opts_complete_pending(opts, argv[cursor-2]);
+        if ((NULL != cfg) && ('-' == argv[cursor-2][1]))
+            opts_complete_values(ofile, cfg, "", 0, word);
+    } else if (NULL != (cfg = opts_complete_pending(opts, prev))) {
+        if (0 == strcmp(word, "="))
+            opts_complete_values(ofile, cfg, word, 1, "");
+        else
+            opts_complete_values(ofile, cfg, "", 0, word);
+    } else if (('-' == word[0]) && ('-' == word[1]) &&
+               (NULL != (equals = strchr(word, '=')))) {
+        cfg = opts_complete_find(opts, &word[2], (size_t)(equals - word) - 2);
+        if ((NULL != cfg) && cfg->has_arg)
+            opts_complete_values(ofile, cfg, word, (size_t)(equals - word) + 1, equals + 1);
+    } else if ('-' == word[0]) {
+        opts_complete_names(ofile, opts, word);
+    }
+}
+
+bool opts_complete_script(FILE* ofile, const char* shell, const char* prog) {
+    const char* base = strrchr(prog, '/');
+    char func[OPT_NAME_MAX];
+    size_t i;
+    base = (NULL == base) ? prog : base + 1;
+    /* Shell function names are limited to identifier characters */
+    for (i = 0; ('\0' != base[i]) && (i < sizeof(func) - 1); i++)
+        func[i] = (opts_char_class(base[i]) & OPTS_ALNUM) ? base[i] : '_';
+    func[i] = '\0';
+
+    if (0 == strcmp(shell, "bash")) {
+        fprintf(ofile,
+            "_%s_opts_complete() {\n"
+            "    local IFS=$'\\n'\n"
+            "    COMPREPLY=( $(OPTS_COMPLETE=$COMP_CWORD \"${COMP_WORDS[@]}\" 2>/dev/null"
+            " | cut -f1) )\n"
+            "}\n"
+            "complete -o default -F _%s_opts_complete %s\n",
+            func, func, base);
+    } else if (0 == strcmp(shell, "zsh")) {
+        fprintf(ofile,
+            "#compdef %s\n"
+            "_%s_opts_complete() {\n"
+            "    local -a candidates\n"
+            "    candidates=( ${(f)\"$(OPTS_COMPLETE=$((CURRENT-1)) \"${(@)words}\""
+            " 2>/dev/null | sed -e 's/:/\\\\:/g' -e 's/\t/:/')\"} )\n"
+            "    if (( ${#candidates} )); then\n"
+            "        _describe 'option' candidates\n"
+            "    else\n"
+            "        _files\n"
+            "    fi\n"
+            "}\n"
+            "compdef _%s_opts_complete %s\n",
+            base, func, func, base);
+    } else if (0 == strcmp(shell, "fish")) {
+        fprintf(ofile,
+            "function __%s_opts_complete\n"
+            "    set -l words (commandline -opc) (commandline -ct)\n"
+            "    env OPTS_COMPLETE=(math (count $words) - 1) $words 2>/dev/null\n"
+            "end\n"
+            "complete -c %s -a '(__%s_opts_complete)'\n",
+            func, base, func);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static opts_cfg_t* opts_complete_find( opts_cfg_t* opts, const char* name, size_t length ) {
+    opts_cfg_t* cfg = opts_complete_lookup(opts, name, length);
+    /* An alias takes its argument and values from the option it names */
+    if ((NULL != cfg) && (NULL != cfg->alias)) {
+        opts_cfg_t* target = opts_complete_lookup(opts, cfg->alias, strlen(cfg->alias));
+        cfg = (NULL != target) ? target : cfg;
+    }
+    return cfg;
+}
+
+static opts_cfg_t* opts_complete_lookup( opts_cfg_t* opts, const char* name,
+                                         size_t length ) {
+    for (; NULL != opts->name; opts++)
+        if ((0 == strncmp(opts->name, name, length)) && ('\0' == opts->name[length]))
+            return opts;
+    return NULL;
+}
+
+/* Returns the option whose value the previous word left outstanding, if any */
+static opts_cfg_t* opts_complete_pending( opts_cfg_t* opts, const char* prev ) {
+    opts_cfg_t* cfg = NULL;
+    if ((NULL == prev) || ('-' != prev[0]) || ('\0' == prev[1]))
+        return NULL;
+    if ('-' == prev[1]) {
+        if (NULL == strchr(prev, '='))
+            cfg = opts_complete_find(opts, &prev[2], strlen(&prev[2]));
+        return ((NULL != cfg) && ('\0' != prev[3]) && cfg->has_arg) ? cfg : NULL;
+    }
+    /* In a group of short options the first one taking a value consumes the
+     * rest of the group, so only a trailing one leaves its value outstanding */
+    for (prev++; '\0' != *prev; prev++) {
+        cfg = opts_complete_find(opts, prev, 1);
+        if ((NULL == cfg) || cfg->has_arg)
+            break;
+    }
+    return ((NULL != cfg) && cfg->has_arg && ('\0' == prev[1])) ? cfg : NULL;
+}
+
+static void opts_complete_names( FILE* ofile, opts_cfg_t* opts, const char* word ) {
+    size_t length = strlen(word);
+    for (; NULL != opts->name; opts++) {
+        bool is_long = ('\0' != opts->name[1]);
+        const char* rest = word + 1;
+        size_t remain = length - 1;
+        if (is_long) {
+            if ((length > 1) && ('-' != word[1]))
+                continue;
+            rest   += (length > 1) ? 1 : 0;
+            remain -= (length > 1) ? 1 : 0;
+        } else if ((length > 1) && ('-' == word[1])) {
+            continue;
+        }
+        if (0 != strncmp(opts->name, rest, remain))
+            continue;
+        fprintf(ofile, "%s%s", is_long ? "--" : "-", opts->name);
+        if (NULL != opts->desc)
+            fprintf(ofile, "\t%s", opts->desc);
+        fputc('\n', ofile);
+    }
+}
+
+static void opts_complete_values( FILE* ofile, opts_cfg_t* cfg, const char* prefix,
+                                  size_t length, const char* word ) {
+    const opts_constraint_t* constraint = cfg->constraint;
+    const char** value;
+    size_t word_len = strlen(word);
+    /* Only an enumeration names its values. Anything else is left to the
+     * shell, which falls back to completing file names. */
+    if ((NULL == constraint) || (OPTS_ENUM != constraint->kind))
+        return;
+    for (value = constraint->values; NULL != *value; value++)
+        if (0 == strncmp(*value, word, word_len))
+            fprintf(ofile, "%.*s%s\n", (int)length, prefix, *value);
+}
+
+/* Incremental Sessions
+ *****************************************************************************/
+opts_session_t* opts_session_new(opts_cfg_t* opts, opts_err_cbfn_t err_cb) {
+    opts_session_t* session = (opts_session_t*)calloc(1, sizeof(opts_session_t));
+    size_t count;
+    if (NULL == session)
+        return NULL;
+    session->err_cb = err_cb;
+    if (opts_compile_schema( &session->schema, opts, NULL )) {
+        count = session->schema.count;
+        session->last  = (size_t*)calloc(count + 1, sizeof(size_t));
+        session->stale = (uint64_t*)calloc(OPT_FLAG_WORDS(count), sizeof(uint64_t));
+    }
+    if ((NULL == session->last) || (NULL == session->stale)) {
+        opts_session_free(session);
+        return NULL;
+    }
+    return session;
+}
+
+void opts_session_free(opts_session_t* session) {
+    size_t i, size;
+    if (NULL == session)
+        return;
+    size = session->cap - (session->gap_end - session->gap_start);
+    for (i = 0; i < size; i++)
+        free(opts_session_elem(session, i)->opts);
+    opts_session_free_results( session );
+    opts_free_schema( &session->schema, NULL );
+    free(session->elems);
+    free(session->last);
+    free(session->stale);
+    free(session->events);
+    free(session);
+}
+
+bool opts_session_edit(opts_session_t* session, opts_edit_t edit, size_t index,
+                       const char* elem) {
+    size_t size = session->cap - (session->gap_end - session->gap_start);
+    uint16_t trailing = opts_session_trailing(session), pending;
+    elem_t* curr;
+    occur_t* opts = NULL;
+    char* text = NULL;
+    if ((OPTS_INSERT == edit) ? (index > size) : (index >= size))
+        return false;
+    /* Everything that can fail is done before the session is touched. An
+     * element holds at most one option per character, plus one for the
+     * argument it may be taken as, and its text is kept after them. */
+    if (OPTS_DELETE != edit) {
+        size_t length = strlen(elem);
+        size_t bytes  = (length + 1) * sizeof(occur_t) + length + 1;
+        if (!opts_session_reserve( session, length ) ||
+            (NULL == (opts = (occur_t*)malloc(bytes))))
+            return false;
+        text = (char*)(opts + length + 1);
+        memcpy(text, elem, length + 1);
+    }
+    opts_session_free_results( session );
+
+    opts_session_move_gap( session, index );
+    if (OPTS_INSERT == edit) {
+        curr = &session->elems[--session->gap_end];
+        opts_session_shift( session, index, 1 );
+        size++;
+    } else {
+        curr = &session->elems[session->gap_end];
+        opts_session_retract( session, curr, index );
+        free(curr->opts);
+        if (OPTS_DELETE == edit) {
+            session->gap_end++;
+            opts_session_shift( session, index, -1 );
+            size--;
+        }
+    }
+    pending = (0 == index) ? OPT_MAX_CFGS : opts_session_elem(session, index-1)->out;
+    if (OPTS_DELETE != edit) {
+        curr->text = text;
+        curr->opts = opts;
+        curr->in   = pending;
+        opts_session_apply( session, curr, index );
+        pending = curr->out;
+        index++;
+    }
+
+    /* The edit reaches no further than the first element that is handed the
+     * same option as before */
+    for (; index < size; index++) {
+        curr = opts_session_elem(session, index);
+        if (curr->in == pending)
+            break;
+        opts_session_retract( session, curr, index );
+        curr->in = pending;
+        opts_session_apply( session, curr, index );
+        pending = curr->out;
+    }
+    opts_session_find_last( session );
+
+    pending = opts_session_trailing(session);
+    if ((pending != trailing) && (OPT_MAX_CFGS != pending) && (NULL != session->err_cb))
+        session->err_cb("Expected an argument, none received",
+                        session->schema.options[pending].name);
+    return true;
+}
+
+size_t opts_session_errors(const opts_session_t* session) {
+    return session->errors + ((OPT_MAX_CFGS != opts_session_trailing(session)) ? 1 : 0);
+}
+
+bool opts_session_is_set(const opts_session_t* session, const char* name,
+                         const char* tag) {
+    query_t query = opts_query(&session->schema, name, tag);
+    occur_t found;
+    const char* text;
+    return opts_session_find( session, &query, &found, &text );
+}
+
+bool opts_session_equal(const opts_session_t* session, const char* name,
+                        const char* tag, const char* value) {
+    const char* found = opts_session_get_value(session, name, tag);
+    return (NULL != found) && (0 == strcmp(value, found));
+}
+
+const char* opts_session_get_value(const opts_session_t* session, const char* name,
+                                   const char* tag) {
+    query_t query = opts_query(&session->schema, name, tag);
+    occur_t found;
+    const char* text;
+    if (!opts_session_find( session, &query, &found, &text ))
+        return NULL;
+    return opts_session_value( session, &found, text );
+}
+
+long opts_session_get_ordinal(const opts_session_t* session, const char* name,
+                              const char* tag) {
+    query_t query = opts_query(&session->schema, name, tag);
+    occur_t found;
+    const char* text;
+    if (!opts_session_find( session, &query, &found, &text ))
+        return -1;
+    return (session->schema.constrained) ? found.ordinal : -1;
+}
+
+/* A selection walks the whole command line, so it is kept until the next edit
+ * in case it is asked for again */
+const char** opts_session_select(const opts_session_t* session, const char* name,
+                                 const char* tag) {
+    query_t query = opts_query(&session->schema, name, tag);
+    uint16_t trailing = opts_session_trailing(session);
+    size_t size = session->cap - (session->gap_end - session->gap_start);
+    size_t count = 0, index = 0, i, j;
+    memo_t* memo = session->memos;
+    while ((NULL != memo) && ((memo->name != query.name) || (memo->tag != query.tag)))
+        memo = memo->next;
+    if (NULL != memo)
+        return memo->items;
+
+    /* Size the array up front so it is only allocated once */
+    for (i = 0; query.valid && (i < size); i++) {
+        const elem_t* elem = opts_session_elem(session, i);
+        for (j = 0; j < elem->num_opts; j++)
+            count += opts_matches_cfg(&session->schema, &query, elem->opts[j].cfg) &&
+                     opts_session_kept(session, elem, i, j);
+    }
+    count += query.valid && (OPT_MAX_CFGS != trailing) &&
+             opts_matches_cfg(&session->schema, &query, trailing);
+    memo = (memo_t*)malloc(sizeof(memo_t) + (count+1) * sizeof(const char*));
+    if (NULL == memo)
+        return NULL;
+    memo->name = query.name;
+    memo->tag  = query.tag;
+
+    /* Most recently parsed options come first */
+    if ((index < count) && (OPT_MAX_CFGS != trailing) &&
+        opts_matches_cfg(&session->schema, &query, trailing))
+        memo->items[index++] = session->schema.options[trailing].name;
+    for (i = size; (index < count) && (i > 0); i--) {
+        const elem_t* elem = opts_session_elem(session, i-1);
+        for (j = elem->num_opts; j > 0; j--)
+            if (opts_matches_cfg(&session->schema, &query, elem->opts[j-1].cfg) &&
+                opts_session_kept(session, elem, i-1, j-1))
+                memo->items[index++] = opts_session_value(session, &elem->opts[j-1],
+                                                          elem->text);
+    }
+    memo->items[index] = NULL;
+    memo->next = session->memos;
+    ((opts_session_t*)session)->memos = memo;
+    return memo->items;
+}
+
+const char** opts_session_arguments(const opts_session_t* session) {
+    size_t index = 0, i = session->cap - (session->gap_end - session->gap_start);
+    const char** args = (const char**)malloc((session->num_args+1) * sizeof(const char*));
+    if (NULL == args)
+        return NULL;
+    /* Most recently parsed arguments come first */
+    for (; (index < session->num_args) && (i > 0); i--) {
+        const elem_t* elem = opts_session_elem(session, i-1);
+        if (elem->arg)
+            args[index++] = elem->text;
+    }
+    args[index] = NULL;
+    return args;
+}
+
+static elem_t* opts_session_elem( const opts_session_t* session, size_t index ) {
+    if (index >= session->gap_start)
+        index += session->gap_end - session->gap_start;
+    return &session->elems[index];
+}
+
+/* Makes room for one more element and for the events of parsing an element of
+ * the given length. An element yields at most one event per character, plus
+ * two for the argument it gives up on and one for a bad value. */
+static bool opts_session_reserve( opts_session_t* session, size_t length ) {
+    if (length + 4 > session->events_cap) {
+        size_t cap = (0 == session->events_cap) ? 64 : session->events_cap;
+        while (cap < length + 4)
+            cap *= 2;
+        if (!opts_grow(NULL, &session->events, session->events_cap, cap, sizeof(event_t)))
+            return false;
+        session->events_cap = cap;
+    }
+    if (session->gap_start == session->gap_end) {
+        size_t cap   = (0 == session->cap) ? 16 : 2 * session->cap;
+        size_t after = session->cap - session->gap_end;
+        if (!opts_grow(NULL, &session->elems, session->cap, cap, sizeof(elem_t)))
+            return false;
+        memmove(&session->elems[cap - after], &session->elems[session->gap_end],
+                after * sizeof(elem_t));
+        session->gap_end = cap - after;
+        session->cap     = cap;
+    }
+    return true;
+}
+
+static void opts_session_move_gap( opts_session_t* session, size_t index ) {
+    size_t gap = session->gap_end - session->gap_start;
+    if (index < session->gap_start) {
+        size_t count = session->gap_start - index;
+        memmove(&session->elems[index + gap], &session->elems[index],
+                count * sizeof(elem_t));
+    } else if (index > session->gap_start) {
+        size_t count = index - session->gap_start;
+        memmove(&session->elems[session->gap_start], &session->elems[session->gap_end],
+                count * sizeof(elem_t));
+    }
+    session->gap_start = index;
+    session->gap_end   = index + gap;
+}
+
+/* Parses the element at the given index given the option the previous one
+ * left waiting, then records what it found and adds it to the totals. Errors
+ * are reported as they are added. */
+static void opts_session_apply( opts_session_t* session, elem_t* elem, size_t index ) {
+    stream_ctx_t stream;
+    size_t i;
+    memset(&stream, 0, sizeof(stream));
+    stream.schema     = &session->schema;
+    stream.pending    = elem->in;
+    stream.record     = true;
+    stream.events     = session->events;
+    stream.events_cap = session->events_cap;
+    opts_parse_element( &stream, elem->text, 0 );
+    session->events     = stream.events;
+    session->events_cap = stream.events_cap;
+    elem->out      = stream.pending;
+    elem->num_opts = 0;
+    elem->errors   = 0;
+    elem->arg      = false;
+    for (i = 0; i < stream.num_events; i++) {
+        const event_t* event = &stream.events[i];
+        if (OPT_EVENT_OPTION == event->kind) {
+            occur_t* occur = &elem->opts[elem->num_opts++];
+            uint16_t cfg   = event->cfg;
+            occur->cfg     = cfg;
+            occur->offset  = (NULL == event->text) ? OPT_NO_VALUE
+                                                   : (uint32_t)(event->text - elem->text);
+            occur->ordinal = event->ordinal;
+            if (session->last[cfg] <= index + 1) {
+                session->last[cfg] = index + 1;
+                session->stale[cfg / 64] &= ~((uint64_t)1 << (cfg % 64));
+            }
+        } else if (OPT_EVENT_ARGUMENT == event->kind) {
+            elem->arg = true;
+            session->num_args++;
+        } else if (OPT_EVENT_ERROR == event->kind) {
+            elem->errors++;
+            session->errors++;
+            if (NULL != session->err_cb) {
+                char opt_name[OPT_NAME_MAX];
+                size_t length = (event->length >= OPT_NAME_MAX) ? OPT_NAME_MAX - 1
+                                                                : event->length;
+                memcpy(opt_name, event->text, length);
+                opt_name[length] = '\0';
+                session->err_cb(event->msg, opt_name);
+            }
+        }
+    }
+}
+
+/* Takes what the element at the given index found back out of the totals */
+static void opts_session_retract( opts_session_t* session, elem_t* elem, size_t index ) {
+    size_t i;
+    for (i = 0; i < elem->num_opts; i++) {
+        uint16_t cfg = elem->opts[i].cfg;
+        if (session->last[cfg] == index + 1)
+            session->stale[cfg / 64] |= (uint64_t)1 << (cfg % 64);
+    }
+    session->errors   -= elem->errors;
+    session->num_args -= elem->arg;
+    elem->num_opts = 0;
+}
+
+/* Moves the last occurrences after an element that is inserted or deleted */
+static void opts_session_shift( opts_session_t* session, size_t index, int delta ) {
+    size_t cfg, first = (delta < 0) ? index + 1 : index;
+    for (cfg = 0; cfg < session->schema.count; cfg++)
+        if (session->last[cfg] > first)
+            session->last[cfg] = (delta < 0) ? session->last[cfg] - 1
+                                             : session->last[cfg] + 1;
+}
+
+/* Searches back from each last occurrence that was taken out for the one
+ * before it, which costs no more than the distance between the two */
+static void opts_session_find_last( opts_session_t* session ) {
+    size_t cfg, index, i;
+    for (cfg = 0; cfg < session->schema.count; cfg++) {
+        if (0 == (session->stale[cfg / 64] & ((uint64_t)1 << (cfg % 64))))
+            continue;
+        session->stale[cfg / 64] &= ~((uint64_t)1 << (cfg % 64));
+        index = session->last[cfg] - 1;
+        session->last[cfg] = 0;
+        while ((0 == session->last[cfg]) && (index-- > 0)) {
+            const elem_t* elem = opts_session_elem(session, index);
+            for (i = 0; i < elem->num_opts; i++)
+                if (elem->opts[i].cfg == cfg)
+                    session->last[cfg] = index + 1;
+        }
+    }
+}
+
+/* Finds the last occurrence of an option matching the query, and the text of
+ * the element it is in. Only the options the query can match are looked at, so
+ * a query by name goes straight to its element. An option the last element
+ * leaves waiting for its argument comes after all of them. */
+static bool opts_session_find( const opts_session_t* session, const query_t* query,
+                               occur_t* found, const char** text ) {
+    uint16_t trailing = opts_session_trailing(session);
+    size_t cfg, last = 0, i;
+    size_t first = (0 == query->name) ? 0 : query->name - 1;
+    size_t end   = (0 == query->name) ? session->schema.count : query->name;
+    const elem_t* elem;
+    if (!query->valid)
+        return false;
+    if ((OPT_MAX_CFGS != trailing) && opts_matches_cfg(&session->schema, query, trailing)) {
+        found->cfg     = trailing;
+        found->offset  = OPT_NO_VALUE;
+        found->ordinal = -1;
+        *text = NULL;
+        return true;
+    }
+    for (cfg = first; cfg < end; cfg++)
+        if (opts_matches_cfg(&session->schema, query, (uint16_t)cfg) &&
+            (session->last[cfg] > last))
+            last = session->last[cfg];
+    if (0 == last)
+        return false;
+    elem = opts_session_elem(session, last-1);
+    for (i = elem->num_opts; i > 0; i--) {
+        if (opts_matches_cfg(&session->schema, query, elem->opts[i-1].cfg)) {
+            *found = elem->opts[i-1];
+            *text  = elem->text;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Whether a full parse would keep an occurrence, which for an option that is
+ * single valued is only true of the last one */
+static bool opts_session_kept( const opts_session_t* session, const elem_t* elem,
+                               size_t index, size_t opt ) {
+    const opts_cfg_t* config = &session->schema.options[elem->opts[opt].cfg];
+    uint16_t cfg = elem->opts[opt].cfg;
+    if (config->multi || ('\0' != config->delim))
+        return true;
+    if ((session->last[cfg] != index + 1) || (cfg == opts_session_trailing(session)))
+        return false;
+    for (opt++; opt < elem->num_opts; opt++)
+        if (elem->opts[opt].cfg == cfg)
+            return false;
+    return true;
+}
+
+static const char* opts_session_value( const opts_session_t* session, const occur_t* occur,
+                                       const char* text ) {
+    if (OPT_NO_VALUE == occur->offset)
+        return session->schema.options[occur->cfg].name;
+    return text + occur->offset;
+}
+
+/* Selections are only valid until the next edit */
+static void opts_session_free_results( opts_session_t* session ) {
+    while (NULL != session->memos) {
+        memo_t* memo = session->memos;
+        session->memos = memo->next;
+        free(memo);
+    }
+}
+
+/* The option the last element leaves waiting for an argument that never comes */
+static uint16_t opts_session_trailing( const opts_session_t* session ) {
+    size_t size = session->cap - (session->gap_end - session->gap_start);
+    return (0 == size) ? OPT_MAX_CFGS : opts_session_elem(session, size-1)->out;
+}
+
+/* Instrumentation
+ *****************************************************************************/
+opts_metrics_t opts_metrics(void) {
+    opts_metrics_t metrics;
+#ifdef OPTS_METRICS
+    /* Every field is a counter of the same type so copy them one by one */
+    const unsigned long long* src = (const unsigned long long*)&Metrics;
+    unsigned long long* dst = (unsigned long long*)&metrics;
+    size_t i;
+    for (i = 0; i < sizeof(metrics) / sizeof(*dst); i++)
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+#else
+    memset(&metrics, 0, sizeof(metrics));
+#endif
+    return metrics;
+}
+
+void opts_metrics_reset(void) {
+#ifdef OPTS_METRICS
+    unsigned long long* dst = (unsigned long long*)&Metrics;
+    size_t i;
+    for (i = 0; i < sizeof(Metrics) / sizeof(*dst); i++)
+        __atomic_store_n(&dst[i], 0, __ATOMIC_RELAXED);
+#endif
+}
+
+void opts_metrics_dump(FILE* ofile) {
+    opts_metrics_t metrics = opts_metrics();
+    fprintf(ofile, "opts_chars %llu\n", metrics.chars);
+    fprintf(ofile, "opts_lookups %llu\n", metrics.lookups);
+    fprintf(ofile, "opts_comparisons %llu\n", metrics.comparisons);
+    fprintf(ofile, "opts_allocations %llu\n", metrics.allocations);
+    fprintf(ofile, "opts_queries{type=\"is_set\"} %llu\n", metrics.queries.is_set);
+    fprintf(ofile, "opts_queries{type=\"equal\"} %llu\n", metrics.queries.equal);
+    fprintf(ofile, "opts_queries{type=\"get_value\"} %llu\n", metrics.queries.get_value);
+    fprintf(ofile, "opts_queries{type=\"get_ordinal\"} %llu\n",
+            metrics.queries.get_ordinal);
+    fprintf(ofile, "opts_queries{type=\"select\"} %llu\n", metrics.queries.select);
+    fprintf(ofile, "opts_queries{type=\"arguments\"} %llu\n", metrics.queries.arguments);
+    fprintf(ofile, "opts_queries{type=\"iter\"} %llu\n", metrics.queries.iter);
+    fprintf(ofile, "opts_phase_ns{phase=\"tokenize\"} %llu\n", metrics.tokenize_ns);
+    fprintf(ofile, "opts_phase_ns{phase=\"lookup\"} %llu\n", metrics.lookup_ns);
+    fprintf(ofile, "opts_phase_ns{phase=\"store\"} %llu\n", metrics.store_ns);
+    fprintf(ofile, "opts_phase_ns{phase=\"query\"} %llu\n", metrics.query_ns);
+}
+
+#ifdef OPTS_METRICS
+static uint64_t opts_clock( void ) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+#endif
@@ -32,12 +32,17 @@
  * In this scenario all of the options that were parsed having the name 'I'
  * would be returned regardless of their tag value. This would equate to all of
  * the instances of '-I' that would occur on the command line for an invocation
- * of gcc.
+ * of gcc, provided '-I' is defined with the multi flag set. Options without it
+ * keep only their last occurrence.
  *
  * With this design you should be able to let the library handle your options
  * parsing while you focus on your application logic using appropriate queries
  * to change behavior where necessary.
  *
+ * The functions above operate on a single global parse result. Programs that
+ * need more than one result at a time can create an opts_ctx_t with
+ * opts_ctx_new and use the equivalent opts_ctx_ functions instead.
+ *
  */
 #ifndef OPTS_H
 #define OPTS_H
@@ -48,8 +53,74 @@ extern "C" {
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+/** Character classes that may be combined to restrict the characters allowed
+ *  in the value of an option */
+#define OPTS_DIGIT 0x01u
+#define OPTS_LOWER 0x02u
+#define OPTS_UPPER 0x04u
+#define OPTS_DASH  0x08u /* '-' and '_' */
+#define OPTS_DOT   0x10u
+#define OPTS_SLASH 0x20u
+#define OPTS_ALPHA (OPTS_LOWER | OPTS_UPPER)
+#define OPTS_ALNUM (OPTS_ALPHA | OPTS_DIGIT)
+#define OPTS_IDENT (OPTS_ALNUM | OPTS_DASH)
+#define OPTS_PATH  (OPTS_IDENT | OPTS_DOT | OPTS_SLASH)
+
+/** The kinds of constraint that can be placed on the value of an option */
+typedef enum {
+    /** The value must be one of a list of strings. Its ordinal is the index
+     *  of the matching string */
+    OPTS_ENUM = 1,
+    /** The value must be a decimal integer within the given bounds. Its
+     *  ordinal is the integer itself */
+    OPTS_RANGE,
+    /** Every character of the value must be in the given character classes */
+    OPTS_CLASS
+} opts_kind_t;
+
+/** Structure describing the values an option will accept. Values that do not
+ *  satisfy the constraint are reported through the error handler during the
+ *  parse */
+typedef struct {
+    /** The kind of check to perform */
+    opts_kind_t kind;
+    /** The NULL terminated list of allowed values for OPTS_ENUM */
+    const char** values;
+    /** The inclusive bounds for OPTS_RANGE */
+    long min;
+    long max;
+    /** The allowed character classes for OPTS_CLASS */
+    unsigned int chars;
+} opts_constraint_t;
+
+/** The kinds of relationship that can be declared between options */
+typedef enum {
+    /** At least one of the matching options must be given as well */
+    OPTS_REQUIRES = 1,
+    /** None of the matching options may be given as well */
+    OPTS_CONFLICTS,
+    /** No more than one of the matching options may be given */
+    OPTS_AT_MOST_ONE,
+    /** Exactly one of the matching options must be given */
+    OPTS_EXACTLY_ONE
+} opts_rule_kind_t;
+
+/** A relationship with the options matching a name and/or tag. As with the
+ *  queries, a NULL name or tag matches everything. The option holding the
+ *  rule is never counted as matching an OPTS_REQUIRES or OPTS_CONFLICTS rule,
+ *  so every option of a tag can share one rule against that tag */
+typedef struct {
+    /** The kind of relationship */
+    opts_rule_kind_t kind;
+    /** The name of the options the rule applies to */
+    const char* name;
+    /** The tag of the options the rule applies to */
+    const char* tag;
+} opts_rule_t;
+
 /** Structure representing an option to be parsed */
 typedef struct {
     /** The name of the option as it will appear on the command line. If the
@@ -64,12 +135,117 @@ typedef struct {
     char* tag;
     /** A short description of the flag used for displaying help messages */
     char* desc;
+    /** An optional constraint on the value of the option */
+    const opts_constraint_t* constraint;
+    /** Flag indicating whether every occurrence of the option is kept. By
+     *  default only the last occurrence is kept and earlier ones are
+     *  discarded as the command line is parsed */
+    bool multi;
+    /** If not NUL the value is a list of items separated by this character.
+     *  The items of every occurrence of the option are merged into one list
+     *  that can be walked with opts_list_begin. List options always keep
+     *  every occurrence */
+    char delim;
+    /** Flag indicating whether the items of a list are key=value pairs */
+    bool pairs;
+    /** If set, this definition is another name for the option with the given
+     *  name and every other field of it is ignored. Both names parse into,
+     *  and are queried as, that one option */
+    char* alias;
+    /** An optional list of rules, ended by one with a kind of zero, checked
+     *  at the end of the parse if this option was given. Rules placed on the
+     *  entry that ends the definitions are always checked. Each violation is
+     *  reported through the error handler */
+    const opts_rule_t* rules;
 } opts_cfg_t;
 
+/** A name and tag resolved against the option definitions by opts_handle.
+ *  Queries made with a handle compare small integers instead of strings */
+typedef uint32_t opts_handle_t;
+
+/** The handle of a name or tag that is not defined. It matches nothing */
+#define OPTS_NO_HANDLE 0xFFFFFFFFu
+
+/** Handler called for each error found while parsing. The option name is a
+ *  temporary copy, truncated to 255 characters, that the handler may modify
+ *  but must not keep or free. It and the message are only valid for the
+ *  duration of the call, so a handler that keeps either must copy it */
 typedef void (*opts_err_cbfn_t)(const char* msg, char* opt_name);
 
+/** A parse result that is independent of the global one. The functions
+ *  prefixed with opts_ctx_ behave exactly like their global counterparts but
+ *  operate on the given context instead */
+typedef struct opts_ctx_t opts_ctx_t;
+
+/** A table of strings shared by any number of contexts, holding one copy of
+ *  each distinct value. It may be used by several threads at once */
+typedef struct opts_intern_t opts_intern_t;
+
+/** A command line that is edited one element at a time and kept parsed as it
+ *  changes. Only the elements an edit can affect are parsed again */
+typedef struct opts_session_t opts_session_t;
+
+/** The kinds of edit that can be made to a session */
+typedef enum {
+    /** The element is inserted before the one at the index */
+    OPTS_INSERT,
+    /** The element at the index is removed */
+    OPTS_DELETE,
+    /** The element at the index is replaced */
+    OPTS_REPLACE
+} opts_edit_t;
+
+/** Callback invoked by opts_parse_stream for each parsed option. The value
+ *  points into argv, or at the option name for options without an argument */
+typedef void (*opts_opt_cbfn_t)(void* user, opts_cfg_t* opt, const char* value,
+                                size_t length, int index);
+
+/** Callback invoked by opts_parse_stream for each positional argument */
+typedef void (*opts_arg_cbfn_t)(void* user, const char* arg, int index);
+
+/** Iterator used to walk parsed options and arguments in command line order */
+typedef struct {
+    /** The definition of the current option, or NULL if the current entry is
+     *  a positional argument */
+    opts_cfg_t* option;
+    /** The value of the current option or the text of the current argument */
+    const char* value;
+    /** The length of the value in characters */
+    size_t length;
+    /** The ordinal the value resolved to, or -1 if it has none */
+    long ordinal;
+    /** The index into argv at which the current entry was found */
+    int index;
+    /* Iteration state, for internal use only */
+    const opts_ctx_t* ctx;
+    size_t name;
+    size_t tag;
+    size_t opt;
+    size_t arg;
+} opts_iter_t;
+
+/** Iterator used to walk the items of a list option. The items are spans of
+ *  the parsed text and are not NUL terminated */
+typedef struct {
+    /** The text of the item, or of its value for a list of pairs. This is
+     *  NULL for a pair that has no '=' */
+    const char* value;
+    /** The length of the value */
+    size_t length;
+    /** The key of the item for a list of pairs, NULL otherwise */
+    const char* key;
+    /** The length of the key */
+    size_t key_length;
+    /* Iteration state, for internal use only */
+    const opts_ctx_t* ctx;
+    bool pairs;
+    size_t span;
+} opts_list_t;
+
 /**
  * Parse the command line options using the provided option definition list.
+ * Parsed options refer back to their definition and to the text of argv rather
+ * than copying either, so both must remain valid until opts_reset is called.
  *
  * @param opts Pointer to a list of option definitions
  * @param argc The number of arguments in the vector
@@ -77,6 +253,83 @@ typedef void (*opts_err_cbfn_t)(const char* msg, char* opt_name);
  */
 void opts_parse(opts_cfg_t* opts, opts_err_cbfn_t err_cb, int argc, char** argv);
 
+/**
+ * Sets when opts_parse and opts_ctx_parse split argv between threads. Above
+ * the threshold argv is cut into one chunk per thread and the chunks are
+ * parsed concurrently. The result, and the errors reported, are identical to
+ * those of a sequential parse. Errors are reported from the calling thread.
+ * This should not be called while a parse is in progress.
+ *
+ * @param min_elems The number of elements of argv, not counting the program
+ *                  name, at which parsing goes parallel. Defaults to 65536.
+ * @param threads   The number of threads to use, or 0 to use one per online
+ *                  processor. Defaults to 0.
+ */
+void opts_parallel(size_t min_elems, unsigned int threads);
+
+/**
+ * Parse a command line held in a single string, as if it had been split into
+ * argv by a POSIX shell. Words are separated by blanks and may be quoted with
+ * single or double quotes or escaped with a backslash. No expansions are
+ * performed. The first word is the program name.
+ *
+ * The string is split in place: each word is unquoted and NUL terminated where
+ * it lies, so the string is modified and must remain valid until opts_reset
+ * is called.
+ *
+ * char line[] = "run --name \"a b\" -x 'c'";
+ * opts_parse_string(Options, NULL, line);
+ *
+ * @param opts   Pointer to a list of option definitions
+ * @param err_cb The error handler to use, or NULL for the current one
+ * @param line   The command line to split and parse
+ */
+void opts_parse_string(opts_cfg_t* opts, opts_err_cbfn_t err_cb, char* line);
+
+/**
+ * Parse the command line options using the provided option definition list
+ * without storing the results. Each option and argument is handed to the
+ * callbacks as soon as it has been parsed, in command line order. Nothing is
+ * retained once this function returns and the query functions are unaffected.
+ * Since nothing is retained the relationship rules are not checked.
+ *
+ * @param opts        Pointer to a list of option definitions
+ * @param err_cb      The error handler to use, or NULL for the current one
+ * @param argc        The number of arguments in the vector
+ * @param argv        The vector of command line arguments
+ * @param on_option   Called for each parsed option, may be NULL
+ * @param on_argument Called for each positional argument, may be NULL
+ * @param user        Passed through to the callbacks
+ *
+ * @return true if no errors were reported, false otherwise.
+ */
+bool opts_parse_stream(opts_cfg_t* opts, opts_err_cbfn_t err_cb, int argc, char** argv,
+                       opts_opt_cbfn_t on_option, opts_arg_cbfn_t on_argument,
+                       void* user);
+
+/**
+ * Same as opts_parse_stream but the lookup tables for the option definitions
+ * are kept in the given context, so they are only built the first time it is
+ * used with these definitions. This avoids the cost of building them, and the
+ * allocations that go with it, on every call. Unlike opts_parse_stream the
+ * relationship rules are checked, since the context keeps track of which
+ * options were given. The context is left holding an empty result.
+ *
+ * @param ctx         The context to keep the lookup tables in
+ * @param opts        Pointer to a list of option definitions
+ * @param err_cb      The error handler to use, or NULL for the default one
+ * @param argc        The number of arguments in the vector
+ * @param argv        The vector of command line arguments
+ * @param on_option   Called for each parsed option, may be NULL
+ * @param on_argument Called for each positional argument, may be NULL
+ * @param user        Passed through to the callbacks
+ *
+ * @return true if no errors were reported, false otherwise.
+ */
+bool opts_ctx_parse_stream(opts_ctx_t* ctx, opts_cfg_t* opts, opts_err_cbfn_t err_cb,
+                           int argc, char** argv, opts_opt_cbfn_t on_option,
+                           opts_arg_cbfn_t on_argument, void* user);
+
 /**
  * Resets the global state back to defaults. This includes freeing any
  * allocated memory and clearing any saved pointers to NULL.
@@ -97,11 +350,12 @@ bool opts_is_set(const char* name, const char* tag);
 
 /**
  * Searches for the last received option with the given name and/or tag and
- * does a string comparison of it's value. The parsed options are stored
- * internally in reverse order so the first match equates to the last option
- * that the parser saw on the command line. The value returned is the text of
- * any argument that was received for the option or the name of the option
- * itself if the option does not take an argument.
+ * does a string comparison of it's value. The parsed options are stored in
+ * the order the parser saw them on the command line and the last match wins.
+ * An option that keeps only its last occurrence is found directly by name,
+ * any other query searches back from the most recent option. The value
+ * compared is the text of any argument that was received for the option or
+ * the name of the option itself if the option does not take an argument.
  *
  * @param name  The name of the option to find.
  * @param tag   The tag of the option to find.
@@ -113,11 +367,12 @@ bool opts_equal(const char* name, const char* tag, const char* value);
 
 /**
  * Search for a parsed option value with the given name and/or tag. If multiple
- * matches are found, only the first match is found. The parsed options are
- * stored internally in reverse order so the first match equates to the last
- * option that the parser saw on the command line. The value returned is the
- * text of any argument that was received for the option or the name of the
- * option itself if the option does not take an argument.
+ * matches are found, only the last one on the command line is returned. The
+ * parsed options are stored in the order the parser saw them, and an option
+ * that keeps only its last occurrence is found directly by name while any
+ * other query searches back from the most recent option. The value returned
+ * is the text of any argument that was received for the option or the name of
+ * the option itself if the option does not take an argument.
  *
  * @param name The name of the option to search for.
  * @param tag  The tag of the option to search for.
@@ -126,12 +381,31 @@ bool opts_equal(const char* name, const char* tag, const char* value);
  */
 const char* opts_get_value(const char* name, const char* tag);
 
+/**
+ * Search for the last received option with the given name and/or tag and
+ * return the ordinal its value resolved to when it was checked against the
+ * option's constraint. For an OPTS_ENUM constraint this is the index of the
+ * matching value, allowing callers to switch on it instead of comparing
+ * strings. For an OPTS_RANGE constraint it is the integer value.
+ *
+ * @param name The name of the option to search for.
+ * @param tag  The tag of the option to search for.
+ *
+ * @return The ordinal of the value, or -1 if no option was found or it has no
+ *         ordinal.
+ */
+long opts_get_ordinal(const char* name, const char* tag);
+
 /**
  * Search for a group of parsed option values with the given name and/or tag.
  * The value returned for each matching option is the text of the argument that
  * was received for the option. If the option does not expect an argument then
  * the value is returned as the name of the option itself.
  *
+ * The array is built the first time a given name and tag are selected and the
+ * same array is returned by every later call. It is owned by the library and
+ * must not be freed. It remains valid until the next parse or opts_reset.
+ *
  * @param name The name of the options to search for.
  * @param tag  The tag of the options to search for.
  *
@@ -139,6 +413,85 @@ const char* opts_get_value(const char* name, const char* tag);
  */
 const char** opts_select(const char* name, const char* tag);
 
+/**
+ * Resolves a name and/or tag to a handle for use with the query functions
+ * ending in _h, which then skip all string comparisons. A value of NULL for
+ * either parameter matches everything, just as it does for the other queries,
+ * and the names of an option and its aliases give the same handle.
+ *
+ * A handle is resolved against the option definitions of the last parse and
+ * stays valid for every later result parsed with the same definitions, so it
+ * can be resolved once and kept.
+ *
+ * @param name The name of the option.
+ * @param tag  The tag of the option.
+ *
+ * @return The handle, or OPTS_NO_HANDLE if the name or tag is not defined.
+ */
+opts_handle_t opts_handle(const char* name, const char* tag);
+
+/** Equivalent of opts_is_set for a handle */
+bool opts_is_set_h(opts_handle_t handle);
+
+/** Equivalent of opts_equal for a handle */
+bool opts_equal_h(opts_handle_t handle, const char* value);
+
+/** Equivalent of opts_get_value for a handle */
+const char* opts_get_value_h(opts_handle_t handle);
+
+/** Equivalent of opts_get_ordinal for a handle */
+long opts_get_ordinal_h(opts_handle_t handle);
+
+/** Equivalent of opts_select for a handle */
+const char** opts_select_h(opts_handle_t handle);
+
+/**
+ * Begins an iteration over the parsed options with the given name and/or tag.
+ * Unlike the other query functions, entries are visited in the order they
+ * appeared on the command line, and positional arguments can be visited in
+ * between the options. No memory is allocated while iterating.
+ *
+ * @param it   The iterator to initialize.
+ * @param name The name of the options to visit.
+ * @param tag  The tag of the options to visit.
+ * @param args Whether positional arguments should be visited as well.
+ */
+void opts_iter_begin(opts_iter_t* it, const char* name, const char* tag, bool args);
+
+/**
+ * Advances the iterator to the next matching option or argument.
+ *
+ * @param it The iterator to advance.
+ *
+ * @return true if the iterator holds a new entry, false once all entries have
+ *         been visited.
+ */
+bool opts_iter_next(opts_iter_t* it);
+
+/**
+ * Starts walking the items of a list option. The items of every occurrence of
+ * the option are visited in command line order. Each value was split once
+ * while parsing, so walking a list does no searching or copying:
+ *
+ * opts_list_t it;
+ * opts_list_begin(&it, "D");
+ * while (opts_list_next(&it))
+ *     define(it.key, it.key_length, it.value, it.length);
+ *
+ * @param it   The iterator to initialize.
+ * @param name The name of the list option.
+ */
+void opts_list_begin(opts_list_t* it, const char* name);
+
+/**
+ * Advances the iterator to the next item of the list.
+ *
+ * @param it The iterator to advance.
+ *
+ * @return true if the iterator now holds an item, false if there are none left.
+ */
+bool opts_list_next(opts_list_t* it);
+
 /**
  * Returns a null terminated array of strings representing the arguments of the
  * executable. These are the entries provided on the command line that are not
@@ -156,6 +509,35 @@ const char** opts_arguments(void);
  */
 const char* opts_prog_name(void);
 
+/**
+ * Returns the options without arguments that were parsed as a set of bits.
+ * Each such option is given a bit in the order it appears in the option
+ * definitions, starting from zero, so the bits can be named by an enum kept in
+ * the same order as the definitions. Bit n is stored in word n / 64.
+ *
+ * if (OPTS_FLAG_SET(opts_flags(), FLAG_VERBOSE)) ...
+ *
+ * The array is owned by the library and remains valid, and is updated in
+ * place, until opts_reset is called. Before any options have been parsed a
+ * separate array is returned instead, in which every possible bit is clear.
+ *
+ * @return Pointer to the words of the bit set.
+ */
+const uint64_t* opts_flags(void);
+
+/**
+ * Returns the bit given to an option without arguments in the set returned by
+ * opts_flags. Bits are only known once options have been parsed.
+ *
+ * @param name The name of the option.
+ *
+ * @return The bit of the option, or -1 if it is unknown or takes an argument.
+ */
+int opts_flag_bit(const char* name);
+
+/** Tests whether the given bit is set in a set returned by opts_flags */
+#define OPTS_FLAG_SET(flags, bit) ((((flags)[(bit) / 64]) >> ((bit) % 64)) & 1u)
+
 /**
  * Prints out the options and their descriptions in a tabular format to the
  * given file handle.
@@ -165,6 +547,376 @@ const char* opts_prog_name(void);
  */
 void opts_print_help(FILE* ofile, opts_cfg_t* opts);
 
+/* Shell Completion
+ *****************************************************************************/
+/**
+ * Prints the completion candidates for one word of a partial command line to
+ * the given file handle, one per line. Option names are followed by a tab and
+ * their description. Values are offered for options constrained to an
+ * OPTS_ENUM. Nothing is printed for positional arguments so that the shell
+ * falls back to its default completion.
+ *
+ * The scripts produced by opts_complete_script run the program itself with the
+ * words of the command line and the index of the word being completed in the
+ * OPTS_COMPLETE environment variable. A program supports them with:
+ *
+ * const char* cursor = getenv("OPTS_COMPLETE");
+ * if (NULL != cursor) {
+ *     opts_complete(stdout, Options, argc, argv, atoi(cursor));
+ *     return 0;
+ * }
+ *
+ * @param ofile  The file handle to use for output.
+ * @param opts   The list of option definitions.
+ * @param argc   The number of words on the command line.
+ * @param argv   The words on the command line, starting with the program name.
+ * @param cursor The index of the word to complete. This may equal argc when
+ *               completing a new, empty word.
+ */
+void opts_complete(FILE* ofile, opts_cfg_t* opts, int argc, char** argv, int cursor);
+
+/**
+ * Prints a script that registers completion for the given program with the
+ * given shell. The script is meant to be sourced by the shell or installed
+ * into its completion directory.
+ *
+ * @param ofile The file handle to use for output.
+ * @param shell One of "bash", "zsh" or "fish".
+ * @param prog  The name of the program to complete.
+ *
+ * @return true if the shell is supported, false otherwise.
+ */
+bool opts_complete_script(FILE* ofile, const char* shell, const char* prog);
+
+/* Instrumentation
+ *****************************************************************************/
+/** Counters and timings gathered across every parse and query made by the
+ *  process. They are only collected when the library is built with
+ *  OPTS_METRICS defined. Otherwise every field stays zero. */
+typedef struct {
+    /** Characters of argv handed to the tokenizer */
+    unsigned long long chars;
+    /** Name, tag and enumerated value lookups */
+    unsigned long long lookups;
+    /** String comparisons made by those lookups */
+    unsigned long long comparisons;
+    /** Heap allocations and reallocations */
+    unsigned long long allocations;
+    /** Calls to each of the query functions */
+    struct {
+        unsigned long long is_set;
+        unsigned long long equal;
+        unsigned long long get_value;
+        unsigned long long get_ordinal;
+        unsigned long long select;
+        unsigned long long arguments;
+        unsigned long long iter;
+    } queries;
+    /** Nanoseconds spent splitting argv into options and arguments */
+    unsigned long long tokenize_ns;
+    /** Nanoseconds spent building lookup tables and resolving names */
+    unsigned long long lookup_ns;
+    /** Nanoseconds spent storing parsed entries */
+    unsigned long long store_ns;
+    /** Nanoseconds spent in the query functions */
+    unsigned long long query_ns;
+} opts_metrics_t;
+
+/**
+ * Returns a copy of the current counters.
+ *
+ * @return The counters gathered since startup or the last reset.
+ */
+opts_metrics_t opts_metrics(void);
+
+/**
+ * Sets every counter back to zero.
+ */
+void opts_metrics_reset(void);
+
+/**
+ * Prints the current counters to the given file handle, one per line in the
+ * Prometheus text format, e.g. 'opts_queries{type="select"} 3'.
+ *
+ * @param ofile The file handle to use for output.
+ */
+void opts_metrics_dump(FILE* ofile);
+
+/* Context Functions
+ *****************************************************************************/
+/**
+ * Allocates a new, empty parse context.
+ *
+ * @return Pointer to the new context.
+ */
+opts_ctx_t* opts_ctx_new(void);
+
+/**
+ * Creates an empty parse context inside the given storage. The context and
+ * everything it holds, including the lookup tables for the option definitions
+ * and the arrays returned by its queries, are placed in the storage and the
+ * heap is never used. Parses into the context are always sequential.
+ *
+ * When the storage runs out the parse reports "Out of storage" through its
+ * error handler and returns false, and select and arguments queries return
+ * NULL. The default handler exits, so a program that wants to act on the
+ * false result must pass a handler that returns. Arrays returned by
+ * opts_ctx_arguments must not be freed and, like those of opts_ctx_select,
+ * remain valid until the next parse.
+ *
+ * The context needs no freeing beyond that of the storage. A few kilobytes
+ * hold the tables for dozens of options and a command line of some hundreds of
+ * elements.
+ *
+ * @param buf  The storage to use, which must remain valid while the context
+ *             is in use.
+ * @param size The size of the storage in bytes.
+ *
+ * @return Pointer to the new context, or NULL if the storage is too small to
+ *         hold even an empty context.
+ */
+opts_ctx_t* opts_ctx_init(void* buf, size_t size);
+
+/**
+ * Frees a parse context along with everything it holds. Contexts created with
+ * opts_ctx_init are left alone.
+ *
+ * @param ctx The context to free.
+ */
+void opts_ctx_free(opts_ctx_t* ctx);
+
+/**
+ * Creates a context that overrides some of the options of a parsed base
+ * context. The overrides are parsed into it with the opts_ctx_ functions,
+ * using the same option definitions as the base, which the overlay shares
+ * rather than building again. An option given in the overlay hides every
+ * occurrence of it in the base. Queries for any other option fall through to
+ * the base, as do the positional arguments when the overlay has none and the
+ * program name. The flags are those of both. Iteration only walks the
+ * overlay's own command line. The relationship rules are checked against the
+ * options of both.
+ *
+ * The base must not be parsed again or freed while the overlay exists, and
+ * may not itself be an overlay. Any number of overlays may share a base.
+ *
+ * @param base The parsed context to override.
+ *
+ * @return The new, empty overlay, or NULL if the base has never been parsed,
+ *         is an overlay, or there was no memory for it.
+ */
+opts_ctx_t* opts_overlay(const opts_ctx_t* base);
+
+/**
+ * Parses the command line into the given context, replacing any previous
+ * result it held. Unlike opts_parse, a NULL error handler selects the default
+ * handler rather than the last one registered.
+ *
+ * @return true if no errors were reported, false otherwise.
+ */
+bool opts_ctx_parse(opts_ctx_t* ctx, opts_cfg_t* opts, opts_err_cbfn_t err_cb,
+                    int argc, char** argv);
+
+/** Context equivalent of opts_parse_string. A NULL error handler selects the
+ *  default handler. Returns true if no errors were reported. */
+bool opts_ctx_parse_string(opts_ctx_t* ctx, opts_cfg_t* opts, opts_err_cbfn_t err_cb,
+                           char* line);
+
+/**
+ * Parses a command line held as a sequence of NUL terminated elements, as
+ * found in /proc/PID/cmdline or produced by xargs -0. The first element is the
+ * program name. The buffer is not modified but must remain valid for as long
+ * as the result is used.
+ *
+ * Reusing the same context and option definitions for every buffer means no
+ * memory is allocated once the context has grown to fit the longest command
+ * line seen.
+ *
+ * @param ctx    The context to parse into.
+ * @param opts   Pointer to a list of option definitions
+ * @param err_cb The error handler to use, or NULL for the default handler
+ * @param buf    The elements of the command line.
+ * @param length The length of the buffer in bytes, including the final NUL.
+ *
+ * @return true if no errors were reported, false otherwise.
+ */
+bool opts_ctx_parse_buffer(opts_ctx_t* ctx, opts_cfg_t* opts, opts_err_cbfn_t err_cb,
+                           const char* buf, size_t length);
+
+/**
+ * Creates an empty intern table. The table never grows its set of buckets, so
+ * it should be sized for the number of distinct values expected.
+ *
+ * @param size The expected number of distinct values, or 0 for a default.
+ *
+ * @return The new table, or NULL if there was no memory for it.
+ */
+opts_intern_t* opts_intern_new(size_t size);
+
+/**
+ * Frees an intern table along with every string it holds. No context may be
+ * using it and none of its strings may be in use.
+ *
+ * @param table The table to free.
+ */
+void opts_intern_free(opts_intern_t* table);
+
+/**
+ * Returns the copy of the string held by the table, adding one if there is
+ * none yet. Equal strings always give the same pointer.
+ *
+ * @param table The table to look in.
+ * @param str   The string to intern.
+ *
+ * @return The interned copy, or NULL if there was no memory for it.
+ */
+const char* opts_intern(opts_intern_t* table, const char* str);
+
+/**
+ * Makes later parses into the context store the values of options in the
+ * given table. Values returned by queries then remain valid until the table
+ * is freed rather than only as long as the command line. opts_ctx_equal
+ * matches a value interned in the same table on its pointer without comparing
+ * the strings, but any other value is still compared in full.
+ * The items of list options are not interned. Interning allocates from the
+ * heap even for contexts created with opts_ctx_init.
+ *
+ * @param ctx   The context to intern values for.
+ * @param table The table to use, or NULL to stop interning.
+ */
+void opts_ctx_use_intern(opts_ctx_t* ctx, opts_intern_t* table);
+
+/** Context equivalent of opts_is_set */
+bool opts_ctx_is_set(const opts_ctx_t* ctx, const char* name, const char* tag);
+
+/** Context equivalent of opts_equal */
+bool opts_ctx_equal(const opts_ctx_t* ctx, const char* name, const char* tag,
+                    const char* value);
+
+/** Context equivalent of opts_get_value */
+const char* opts_ctx_get_value(const opts_ctx_t* ctx, const char* name, const char* tag);
+
+/** Context equivalent of opts_get_ordinal */
+long opts_ctx_get_ordinal(const opts_ctx_t* ctx, const char* name, const char* tag);
+
+/** Context equivalent of opts_select */
+const char** opts_ctx_select(const opts_ctx_t* ctx, const char* name, const char* tag);
+
+/** Context equivalent of opts_handle */
+opts_handle_t opts_ctx_handle(const opts_ctx_t* ctx, const char* name, const char* tag);
+
+/** Context equivalent of opts_is_set_h */
+bool opts_ctx_is_set_h(const opts_ctx_t* ctx, opts_handle_t handle);
+
+/** Context equivalent of opts_equal_h */
+bool opts_ctx_equal_h(const opts_ctx_t* ctx, opts_handle_t handle, const char* value);
+
+/** Context equivalent of opts_get_value_h */
+const char* opts_ctx_get_value_h(const opts_ctx_t* ctx, opts_handle_t handle);
+
+/** Context equivalent of opts_get_ordinal_h */
+long opts_ctx_get_ordinal_h(const opts_ctx_t* ctx, opts_handle_t handle);
+
+/** Context equivalent of opts_select_h */
+const char** opts_ctx_select_h(const opts_ctx_t* ctx, opts_handle_t handle);
+
+/** Context equivalent of opts_arguments */
+const char** opts_ctx_arguments(const opts_ctx_t* ctx);
+
+/** Context equivalent of opts_prog_name */
+const char* opts_ctx_prog_name(const opts_ctx_t* ctx);
+
+/** Context equivalent of opts_list_begin */
+void opts_ctx_list_begin(const opts_ctx_t* ctx, opts_list_t* it, const char* name);
+
+/** Context equivalent of opts_flags */
+const uint64_t* opts_ctx_flags(const opts_ctx_t* ctx);
+
+/** Context equivalent of opts_flag_bit */
+int opts_ctx_flag_bit(const opts_ctx_t* ctx, const char* name);
+
+/** Context equivalent of opts_iter_begin */
+void opts_ctx_iter_begin(const opts_ctx_t* ctx, opts_iter_t* it, const char* name,
+                         const char* tag, bool args);
+
+/**
+ * Creates an empty session. Unlike a parse context, a session holds the
+ * command line without the program name, so index 0 is the first argument.
+ * The relationship rules of the options are not checked.
+ *
+ * @param opts   Pointer to a list of option definitions. These must remain
+ *               valid until the session is freed.
+ * @param err_cb Called for each error an edit introduces, or NULL to only
+ *               count them. Unlike the default handler of opts_parse it is
+ *               expected to return.
+ *
+ * @return The new session, or NULL if it could not be created.
+ */
+opts_session_t* opts_session_new(opts_cfg_t* opts, opts_err_cbfn_t err_cb);
+
+/**
+ * Frees a session and the copies it holds of its elements.
+ *
+ * @param session The session to free.
+ */
+void opts_session_free(opts_session_t* session);
+
+/**
+ * Edits the command line of a session. The edited element is parsed, followed
+ * by the elements after it only for as long as the option they take their
+ * argument from changes. The elements are kept in a gap buffer, so an edit
+ * close to the previous one costs the same however long the command line is.
+ *
+ * @param session The session to edit.
+ * @param edit    The kind of edit to make.
+ * @param index   The index of the element to edit.
+ * @param elem    The element to insert or replace with, copied by the session.
+ *                Ignored when deleting.
+ *
+ * @return false if the index is out of range or there was no memory for the
+ *         edit, in which case the session is unchanged.
+ */
+bool opts_session_edit(opts_session_t* session, opts_edit_t edit, size_t index,
+                       const char* elem);
+
+/**
+ * Returns the number of errors in the command line of a session as it stands.
+ *
+ * @param session The session to check.
+ *
+ * @return The number of errors.
+ */
+size_t opts_session_errors(const opts_session_t* session);
+
+/**
+ * Session equivalent of opts_is_set. Every edit keeps track of the element that
+ * holds the last occurrence of each option, so this and the other queries for
+ * the last occurrence cost the same however long the command line is.
+ */
+bool opts_session_is_set(const opts_session_t* session, const char* name,
+                         const char* tag);
+
+/** Session equivalent of opts_equal */
+bool opts_session_equal(const opts_session_t* session, const char* name,
+                        const char* tag, const char* value);
+
+/** Session equivalent of opts_get_value. The value is only valid until the
+ *  next edit */
+const char* opts_session_get_value(const opts_session_t* session, const char* name,
+                                   const char* tag);
+
+/** Session equivalent of opts_get_ordinal */
+long opts_session_get_ordinal(const opts_session_t* session, const char* name,
+                              const char* tag);
+
+/** Session equivalent of opts_select. It walks the whole command line, and the
+ *  array is owned by the session and only valid until the next edit */
+const char** opts_session_select(const opts_session_t* session, const char* name,
+                                 const char* tag);
+
+/** Session equivalent of opts_arguments. It walks the whole command line, and
+ *  the strings in the array are only valid until the next edit */
+const char** opts_session_arguments(const opts_session_t* session);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,419 @@
+/**
+ * @file
+ *
+ * A thin C++20 wrapper around the opts library. The wrapper adds no storage of
+ * its own: values are returned as std::string_view into argv, selections are
+ * returned as std::span over the arrays built by the C library, and the parse
+ * result is a move-only object that frees its context when destroyed. Each
+ * result is an independent opts_ctx_t, so the global state used by the plain
+ * C interface is never touched.
+ *
+ * opts_cfg_t options[] = { ... };
+ *
+ * opts::parser parser(options);
+ * opts::result res = parser.parse(argc, argv);
+ * for (const opts::entry& e : res.entries("I"))
+ *     add_include_dir(e.value);
+ *
+ * When the option definitions are known at compile time they can instead be
+ * declared as a constexpr array and handed to opts::static_parser. Only the
+ * lookups are specialized: each option name is resolved to a fixed slot at
+ * compile time, so a misspelled name is a compile error and each lookup is a
+ * single array access. The command line itself is still parsed by the C
+ * library, using lookup tables that are built the first time each thread
+ * parses with a given array and reused after that:
+ *
+ * constexpr opts::option Options[] = {
+ *     { "threads", true,  "perf", "Number of worker threads" },
+ *     { "v",       false, "log",  "Verbose output" },
+ * };
+ *
+ * auto res = opts::static_parser<Options>().parse(argc, argv);
+ * if (res.is_set<"v">()) ...
+ * std::string_view threads = res.get<"threads">();
+ */
+#ifndef OPTS_HPP
+#define OPTS_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+#include <span>
+#include <string_view>
+#include <utility>
+#include "opts.h"
+
+namespace opts {
+
+/** An option or positional argument visited by a view */
+struct entry {
+    /** The definition of the option, or nullptr for a positional argument */
+    const opts_cfg_t* option;
+    /** The value of the option or the text of the argument */
+    std::string_view value;
+    /** The index into argv at which the entry was found */
+    int index;
+    /** The ordinal the value resolved to, or -1 if it has none */
+    long ordinal = -1;
+};
+
+/** A lazy range over the entries of a result, in command line order */
+class view {
+public:
+    class iterator {
+    public:
+        using value_type      = entry;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        explicit iterator(const opts_iter_t& it) : it_(it) { ++*this; }
+
+        entry operator*() const {
+            return { it_.option, std::string_view(it_.value, it_.length), it_.index,
+                     it_.ordinal };
+        }
+        iterator& operator++() { done_ = !opts_iter_next(&it_); return *this; }
+        void operator++(int) { ++*this; }
+        bool operator==(std::default_sentinel_t) const { return done_; }
+
+    private:
+        opts_iter_t it_{};
+        bool done_ = true;
+    };
+
+    view(const opts_ctx_t* ctx, const char* name, const char* tag, bool args) {
+        opts_ctx_iter_begin(ctx, &it_, name, tag, args);
+    }
+
+    iterator begin() const { return iterator(it_); }
+    std::default_sentinel_t end() const { return {}; }
+
+private:
+    opts_iter_t it_;
+};
+
+/** Owns the NULL terminated array returned by opts_ctx_arguments, which is
+ *  empty if there was no memory for the array */
+class selection {
+public:
+    explicit selection(const char** items) : items_(items) {
+        while ((items_ != nullptr) && (items_[size_] != nullptr))
+            size_++;
+    }
+    selection(selection&& other) noexcept
+        : items_(std::exchange(other.items_, nullptr)),
+          size_(std::exchange(other.size_, 0)) {}
+    selection& operator=(selection&& other) noexcept {
+        std::swap(items_, other.items_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+    selection(const selection&) = delete;
+    selection& operator=(const selection&) = delete;
+    ~selection() { std::free(items_); }
+
+    std::span<const char* const> span() const { return { items_, size_ }; }
+    operator std::span<const char* const>() const { return span(); }
+    auto begin() const { return span().begin(); }
+    auto end() const { return span().end(); }
+    std::size_t size() const { return size_; }
+    bool empty() const { return 0 == size_; }
+
+private:
+    const char** items_;
+    std::size_t size_ = 0;
+};
+
+/** The result of parsing a command line. Values refer into the argv that was
+ *  parsed, which must outlive the result. */
+class result {
+public:
+    result(result&& other) noexcept
+        : ctx_(std::exchange(other.ctx_, nullptr)), ok_(other.ok_) {}
+    result& operator=(result&& other) noexcept {
+        std::swap(ctx_, other.ctx_);
+        std::swap(ok_, other.ok_);
+        return *this;
+    }
+    result(const result&) = delete;
+    result& operator=(const result&) = delete;
+    ~result() { opts_ctx_free(ctx_); }
+
+    /** Whether the parse completed without reporting any errors */
+    explicit operator bool() const { return ok_; }
+
+    bool is_set(const char* name, const char* tag = nullptr) const {
+        return opts_ctx_is_set(ctx_, name, tag);
+    }
+
+    /** The value of the last matching option, or an empty view with a null
+     *  data pointer if there is none */
+    std::string_view value(const char* name, const char* tag = nullptr) const {
+        const char* value = opts_ctx_get_value(ctx_, name, tag);
+        return (value != nullptr) ? std::string_view(value) : std::string_view();
+    }
+
+    /** The ordinal the value of the last matching option resolved to */
+    long ordinal(const char* name, const char* tag = nullptr) const {
+        return opts_ctx_get_ordinal(ctx_, name, tag);
+    }
+
+    bool equal(const char* name, const char* tag, std::string_view expected) const {
+        const char* value = opts_ctx_get_value(ctx_, name, tag);
+        return (value != nullptr) && (expected == value);
+    }
+
+    /** The values of the matching options, most recent first. The span is
+     *  owned by the result and remains valid for as long as it does. It is
+     *  empty if there was no memory for the selection. */
+    std::span<const char* const> select(const char* name, const char* tag = nullptr) const {
+        const char** items = opts_ctx_select(ctx_, name, tag);
+        std::size_t size = 0;
+        if (items == nullptr)
+            return {};
+        while (items[size] != nullptr)
+            size++;
+        return { items, size };
+    }
+
+    selection arguments() const {
+        return selection(opts_ctx_arguments(ctx_));
+    }
+
+    /** The matching options, optionally interleaved with the positional
+     *  arguments, in command line order */
+    view entries(const char* name = nullptr, const char* tag = nullptr,
+                 bool args = false) const {
+        return view(ctx_, name, tag, args);
+    }
+
+    /** The options without arguments that were parsed, as a set of bits */
+    const std::uint64_t* flags() const { return opts_ctx_flags(ctx_); }
+
+    int flag_bit(const char* name) const { return opts_ctx_flag_bit(ctx_, name); }
+
+    std::string_view prog_name() const {
+        const char* name = opts_ctx_prog_name(ctx_);
+        return (name != nullptr) ? std::string_view(name) : std::string_view();
+    }
+
+    const opts_ctx_t* get() const { return ctx_; }
+
+private:
+    friend class parser;
+    result(opts_ctx_t* ctx, bool ok) : ctx_(ctx), ok_(ok) {}
+
+    opts_ctx_t* ctx_;
+    bool ok_;
+};
+
+/** Parses command lines against a fixed list of option definitions */
+class parser {
+public:
+    explicit parser(opts_cfg_t* options, opts_err_cbfn_t err_cb = nullptr)
+        : options_(options), err_cb_(err_cb) {}
+
+    /** Throws std::bad_alloc if there is no memory for the result */
+    result parse(int argc, char** argv) const {
+        opts_ctx_t* ctx = opts_ctx_new();
+        if (ctx == nullptr)
+            throw std::bad_alloc();
+        bool ok = opts_ctx_parse(ctx, options_, err_cb_, argc, argv);
+        return result(ctx, ok);
+    }
+
+    /** Parses without storing anything, calling on_option(entry) and
+     *  on_argument(entry) for each entry in command line order */
+    template <typename OnOption, typename OnArgument>
+    void stream(int argc, char** argv, OnOption&& on_option,
+                OnArgument&& on_argument) const {
+        struct callbacks {
+            OnOption& on_option;
+            OnArgument& on_argument;
+        } cbs{ on_option, on_argument };
+        opts_parse_stream(options_, err_cb_, argc, argv,
+            [](void* user, opts_cfg_t* opt, const char* value, size_t length, int index) {
+                entry e{ opt, { value, length }, index };
+                static_cast<callbacks*>(user)->on_option(e);
+            },
+            [](void* user, const char* arg, int index) {
+                static_cast<callbacks*>(user)->on_argument(entry{ nullptr, arg, index });
+            },
+            &cbs);
+    }
+
+private:
+    opts_cfg_t* options_;
+    opts_err_cbfn_t err_cb_;
+};
+
+/* Compile-Time Schemas
+ *****************************************************************************/
+/** Option definition usable in constant expressions. It mirrors the fields of
+ *  opts_cfg_t but holds const pointers so it can be built from literals. */
+struct option {
+    const char* name;
+    bool has_arg;
+    const char* tag;
+    const char* desc;
+    const opts_constraint_t* constraint = nullptr;
+    bool multi = false;
+    char delim = '\0';
+    bool pairs = false;
+    const char* alias = nullptr;
+    const opts_rule_t* rules = nullptr;
+};
+
+/** A string literal that can be passed as a template argument */
+template <std::size_t N>
+struct name {
+    char text[N];
+    consteval name(const char (&str)[N]) {
+        for (std::size_t i = 0; i < N; i++)
+            text[i] = str[i];
+    }
+    constexpr std::string_view view() const { return { text, N - 1 }; }
+};
+
+/** Returns the index of the named option in Options. An alias gives the index
+ *  of the option it names. Unknown names cannot be evaluated at compile time
+ *  and are rejected by the compiler. */
+template <const auto& Options>
+consteval std::size_t index_of(std::string_view name) {
+    for (std::size_t i = 0; i < std::size(Options); i++)
+        if (std::string_view(Options[i].name) == name)
+            return (Options[i].alias == nullptr) ? i : index_of<Options>(Options[i].alias);
+    throw "unknown option name";
+}
+
+/** Returns the bit given to the named option in static_result::flags. Options
+ *  without arguments are numbered in the order they appear in Options, and an
+ *  alias shares the bit of the option it names. */
+template <const auto& Options>
+consteval std::size_t flag_bit(std::string_view name) {
+    std::size_t target = index_of<Options>(name);
+    std::size_t bit = 0;
+    if (Options[target].has_arg)
+        throw "option takes an argument";
+    for (std::size_t i = 0; i < target; i++)
+        bit += (Options[i].has_arg || (Options[i].alias != nullptr)) ? 0 : 1;
+    return bit;
+}
+
+/** The result of a static_parser. Every option has a fixed slot holding its
+ *  last value and the number of times it occurred. */
+template <const auto& Options>
+class static_result {
+public:
+    static constexpr std::size_t size = std::size(Options);
+
+    template <name Name>
+    bool is_set() const { return 0 != counts_[index_of<Options>(Name.view())]; }
+
+    template <name Name>
+    std::size_t count() const { return counts_[index_of<Options>(Name.view())]; }
+
+    /** The value of the last occurrence of the option, or an empty view with a
+     *  null data pointer if it was not set */
+    template <name Name>
+    std::string_view get() const { return values_[index_of<Options>(Name.view())]; }
+
+    /** The options without arguments that were set, bit flag_bit<Options>(name)
+     *  of the set being that of the named option */
+    std::span<const std::uint64_t> flags() const { return flags_; }
+
+    /** Whether the parse completed without reporting any errors */
+    explicit operator bool() const { return ok_; }
+
+private:
+    template <const auto&> friend class static_parser;
+
+    static constexpr std::array<std::size_t, size> bits = [] {
+        std::array<std::size_t, size> bits{};
+        std::size_t bit = 0;
+        for (std::size_t i = 0; i < size; i++)
+            bits[i] = (Options[i].has_arg || (Options[i].alias != nullptr)) ? 0 : bit++;
+        return bits;
+    }();
+
+    std::array<std::string_view, size> values_{};
+    std::array<std::size_t, size> counts_{};
+    std::array<std::uint64_t, size / 64 + 1> flags_{};
+    bool ok_ = true;
+};
+
+/** Parses command lines against a constexpr array of opts::option */
+template <const auto& Options>
+class static_parser {
+public:
+    explicit static_parser(opts_err_cbfn_t err_cb = nullptr) : err_cb_(err_cb) {}
+
+    static_result<Options> parse(int argc, char** argv) const {
+        return parse(argc, argv, [](const entry&) {});
+    }
+
+    /** Parses the command line, calling on_argument(entry) for each
+     *  positional argument since the result does not retain them. Throws
+     *  std::bad_alloc if there is no memory for the lookup tables. */
+    template <typename OnArgument>
+    static_result<Options> parse(int argc, char** argv, OnArgument&& on_argument) const {
+        struct state {
+            static_result<Options> res;
+            OnArgument& on_argument;
+        } st{ {}, on_argument };
+        st.res.ok_ = opts_ctx_parse_stream(schema(), table.data(), err_cb_, argc, argv,
+            [](void* user, opts_cfg_t* opt, const char* value, size_t length, int) {
+                /* The definition's position in the table is its slot */
+                state* st = static_cast<state*>(user);
+                std::size_t slot = static_cast<std::size_t>(opt - table.data());
+                st->res.values_[slot] = std::string_view(value, length);
+                st->res.counts_[slot]++;
+                if (!opt->has_arg) {
+                    std::size_t bit = static_result<Options>::bits[slot];
+                    st->res.flags_[bit / 64] |= std::uint64_t(1) << (bit % 64);
+                }
+            },
+            [](void* user, const char* arg, int index) {
+                static_cast<state*>(user)->on_argument(entry{ nullptr, arg, index });
+            },
+            &st);
+        return st.res;
+    }
+
+private:
+    template <std::size_t... I>
+    static std::array<opts_cfg_t, sizeof...(I) + 1> make_table(std::index_sequence<I...>) {
+        return { { { const_cast<char*>(Options[I].name), Options[I].has_arg,
+                     const_cast<char*>(Options[I].tag), const_cast<char*>(Options[I].desc),
+                     Options[I].constraint, Options[I].multi, Options[I].delim,
+                     Options[I].pairs, const_cast<char*>(Options[I].alias),
+                     Options[I].rules }...,
+                   { nullptr, false, nullptr, nullptr, nullptr, false, '\0', false, nullptr,
+                     nullptr } } };
+    }
+
+    static inline std::array<opts_cfg_t, std::size(Options) + 1> table =
+        make_table(std::make_index_sequence<std::size(Options)>());
+
+    /** The context holding the lookup tables for the table. Each thread has
+     *  its own since a parse resets the context it uses. */
+    static opts_ctx_t* schema() {
+        struct holder {
+            opts_ctx_t* ctx = opts_ctx_new();
+            ~holder() { opts_ctx_free(ctx); }
+        };
+        static thread_local holder cache;
+        if (cache.ctx == nullptr)
+            throw std::bad_alloc();
+        return cache.ctx;
+    }
+
+    opts_err_cbfn_t err_cb_;
+};
+
+}
+
+#endif
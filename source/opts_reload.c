@@ -0,0 +1,305 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sched.h>
+#include "opts_reload.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+/* Type and Function Declarations
+ *****************************************************************************/
+typedef struct {
+    opts_ctx_t* ctx;
+    char* text;
+    char** argv;
+} snapshot_t;
+
+struct opts_reload_t {
+    opts_cfg_t* options;
+    opts_err_cbfn_t err_cb;
+    char* path;
+    /* Readers register against the parity of the current epoch. A writer
+     * publishes, bumps the epoch and waits for the old parity to drain. */
+    snapshot_t* current;
+    unsigned long epoch;
+    unsigned long readers[2];
+    pthread_mutex_t lock;
+#ifdef __linux__
+    bool watching;
+    pthread_t thread;
+    int notify_fd;
+    int wake_fds[2];
+#endif
+};
+
+static snapshot_t* opts_reload_read( opts_reload_t* reload );
+static void opts_reload_free( snapshot_t* snapshot );
+static void opts_reload_error(const char* msg, char* opt_name);
+#ifdef __linux__
+static bool opts_reload_watch( opts_reload_t* reload );
+static void* opts_reload_thread( void* arg );
+#endif
+
+#define LOAD(ptr)          __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define EXCHANGE(ptr, val) __atomic_exchange_n((ptr), (val), __ATOMIC_SEQ_CST)
+#define INCREMENT(ptr)     __atomic_add_fetch((ptr), 1, __ATOMIC_SEQ_CST)
+#define DECREMENT(ptr)     __atomic_sub_fetch((ptr), 1, __ATOMIC_SEQ_CST)
+
+/* Starting and Stopping
+ *****************************************************************************/
+opts_reload_t* opts_reload_start(opts_cfg_t* opts, opts_err_cbfn_t err_cb,
+                                 const char* path) {
+    opts_reload_t* reload = (opts_reload_t*)calloc(1, sizeof(opts_reload_t));
+    if (NULL == reload)
+        return NULL;
+    reload->options = opts;
+    reload->err_cb  = (NULL != err_cb) ? err_cb : &opts_reload_error;
+    reload->path    = (char*)malloc(strlen(path) + 1);
+    if (NULL == reload->path) {
+        free(reload);
+        return NULL;
+    }
+    strcpy(reload->path, path);
+    pthread_mutex_init(&reload->lock, NULL);
+#ifdef __linux__
+    reload->watching = opts_reload_watch( reload );
+#endif
+    (void)opts_reload_now( reload );
+    return reload;
+}
+
+void opts_reload_stop(opts_reload_t* reload) {
+    if (NULL == reload)
+        return;
+#ifdef __linux__
+    if (reload->watching) {
+        char wake = 0;
+        (void)write(reload->wake_fds[1], &wake, 1);
+        pthread_join(reload->thread, NULL);
+        close(reload->notify_fd);
+        close(reload->wake_fds[0]);
+        close(reload->wake_fds[1]);
+    }
+#endif
+    opts_reload_free( reload->current );
+    pthread_mutex_destroy(&reload->lock);
+    free(reload->path);
+    free(reload);
+}
+
+/* Publishing Snapshots
+ *****************************************************************************/
+bool opts_reload_now(opts_reload_t* reload) {
+    snapshot_t* snapshot = opts_reload_read( reload );
+    unsigned long epoch;
+    if (NULL == snapshot)
+        return false;
+
+    /* Only one writer at a time may flip the epoch */
+    pthread_mutex_lock(&reload->lock);
+    snapshot = EXCHANGE(&reload->current, snapshot);
+    epoch    = INCREMENT(&reload->epoch) - 1;
+
+    /* Readers of the old parity may still hold the old snapshot. New readers
+     * register against the new parity and can only see the new snapshot. */
+    while (0 != LOAD(&reload->readers[epoch & 1]))
+        sched_yield();
+    pthread_mutex_unlock(&reload->lock);
+
+    opts_reload_free( snapshot );
+    return true;
+}
+
+opts_snapshot_t opts_reload_acquire(opts_reload_t* reload) {
+    opts_snapshot_t snapshot;
+    for (;;) {
+        snapshot.epoch = LOAD(&reload->epoch);
+        INCREMENT(&reload->readers[snapshot.epoch & 1]);
+        /* If the epoch moved on we may have registered too late to hold off
+         * the writer, so back out and try again */
+        if (LOAD(&reload->epoch) == snapshot.epoch)
+            break;
+        DECREMENT(&reload->readers[snapshot.epoch & 1]);
+    }
+    snapshot_t* current = LOAD(&reload->current);
+    snapshot.ctx = (NULL == current) ? NULL : current->ctx;
+    return snapshot;
+}
+
+void opts_reload_release(opts_reload_t* reload, opts_snapshot_t snapshot) {
+    DECREMENT(&reload->readers[snapshot.epoch & 1]);
+}
+
+/* Reading the Configuration File
+ *****************************************************************************/
+static snapshot_t* opts_reload_read( opts_reload_t* reload ) {
+    snapshot_t* snapshot = NULL;
+    FILE* file = fopen(reload->path, "rb");
+    size_t size = 0, cap = 256, argc = 1, i;
+    char* text = (char*)malloc(cap);
+    char** argv;
+    bool in_token = false, in_comment = false;
+
+    if (NULL == file) {
+        reload->err_cb(strerror(errno), reload->path);
+        free(text);
+        return NULL;
+    }
+    if (NULL == text) {
+        fclose(file);
+        reload->err_cb("Out of memory", reload->path);
+        return NULL;
+    }
+    for (;;) {
+        char* grown;
+        size += fread(&text[size], 1, cap - size - 1, file);
+        if (size < cap - 1)
+            break;
+        cap  *= 2;
+        grown = (char*)realloc(text, cap);
+        if (NULL == grown) {
+            fclose(file);
+            free(text);
+            reload->err_cb("Out of memory", reload->path);
+            return NULL;
+        }
+        text = grown;
+    }
+    fclose(file);
+    text[size] = '\0';
+
+    /* Split the text into tokens in place, dropping comments */
+    for (i = 0; i < size; i++) {
+        if (('#' == text[i]) && !in_token)
+            in_comment = true;
+        else if ('\n' == text[i])
+            in_comment = false;
+        if (in_comment || isspace((unsigned char)text[i])) {
+            text[i]  = '\0';
+            in_token = false;
+        } else if (!in_token) {
+            in_token = true;
+            argc++;
+        }
+    }
+    argv = (char**)malloc((argc + 1) * sizeof(char*));
+    if (NULL == argv) {
+        free(text);
+        reload->err_cb("Out of memory", reload->path);
+        return NULL;
+    }
+    argv[0] = reload->path;
+    for (argc = 1, i = 0; i < size; i++)
+        if (('\0' != text[i]) && ((0 == i) || ('\0' == text[i-1])))
+            argv[argc++] = &text[i];
+    argv[argc] = NULL;
+
+    snapshot = (snapshot_t*)malloc(sizeof(snapshot_t));
+    if (NULL == snapshot) {
+        free(text);
+        free(argv);
+        reload->err_cb("Out of memory", reload->path);
+        return NULL;
+    }
+    snapshot->ctx  = opts_ctx_new();
+    snapshot->text = text;
+    snapshot->argv = argv;
+    if (NULL == snapshot->ctx) {
+        opts_reload_free( snapshot );
+        reload->err_cb("Out of memory", reload->path);
+        return NULL;
+    }
+    if (!opts_ctx_parse(snapshot->ctx, reload->options, reload->err_cb, (int)argc, argv)) {
+        opts_reload_free( snapshot );
+        snapshot = NULL;
+    }
+    return snapshot;
+}
+
+static void opts_reload_free( snapshot_t* snapshot ) {
+    if (NULL != snapshot) {
+        opts_ctx_free(snapshot->ctx);
+        free(snapshot->text);
+        free(snapshot->argv);
+        free(snapshot);
+    }
+}
+
+static void opts_reload_error(const char* msg, char* opt_name) {
+    fprintf(stderr, "Option '%s' : %s\n", opt_name, msg);
+}
+
+/* Watching for Changes
+ *****************************************************************************/
+#ifdef __linux__
+static bool opts_reload_watch( opts_reload_t* reload ) {
+    /* Watch the directory rather than the file so that editors which replace
+     * the file instead of rewriting it are noticed as well */
+    char* slash = strrchr(reload->path, '/');
+    char* dir   = (NULL == slash) ? "." : reload->path;
+    bool ok;
+    if (NULL != slash)
+        *slash = '\0';
+    reload->notify_fd = inotify_init();
+    ok = (reload->notify_fd >= 0) &&
+         (inotify_add_watch(reload->notify_fd, (slash == reload->path) ? "/" : dir,
+                            IN_CLOSE_WRITE | IN_MOVED_TO) >= 0);
+    if (NULL != slash)
+        *slash = '/';
+    if (ok && (0 == pipe(reload->wake_fds))) {
+        if (0 == pthread_create(&reload->thread, NULL, &opts_reload_thread, reload))
+            return true;
+        close(reload->wake_fds[0]);
+        close(reload->wake_fds[1]);
+    }
+    if (reload->notify_fd >= 0)
+        close(reload->notify_fd);
+    return false;
+}
+
+static void* opts_reload_thread( void* arg ) {
+    opts_reload_t* reload = (opts_reload_t*)arg;
+    const char* slash = strrchr(reload->path, '/');
+    const char* base  = (NULL == slash) ? reload->path : slash + 1;
+    union {
+        struct inotify_event event;
+        char bytes[4096];
+    } buffer;
+    struct pollfd fds[2];
+    fds[0].fd = reload->notify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = reload->wake_fds[0];
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        bool changed = false;
+        ssize_t length, offset = 0;
+        /* A signal only interrupts the wait, the thread keeps watching until
+         * it is told to stop or polling fails outright */
+        if (poll(fds, 2, -1) < 0) {
+            if (EINTR == errno)
+                continue;
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+            break;
+        length = read(reload->notify_fd, buffer.bytes, sizeof(buffer));
+        while (offset < length) {
+            struct inotify_event* event = (struct inotify_event*)&buffer.bytes[offset];
+            if ((event->len > 0) && (0 == strcmp(event->name, base)))
+                changed = true;
+            offset += sizeof(struct inotify_event) + event->len;
+        }
+        if (changed)
+            (void)opts_reload_now( reload );
+    }
+    return NULL;
+}
+#endif
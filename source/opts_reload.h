@@ -0,0 +1,104 @@
+/**
+ * @file
+ *
+ * Hot reloading of options from a configuration file. The file holds options
+ * written exactly as they would be on the command line, separated by any
+ * whitespace, with '#' starting a comment that runs to the end of the line:
+ *
+ * # worker settings
+ * --threads=8
+ * --mode fast
+ *
+ * Each time the file changes it is parsed into a new, immutable parse context
+ * which is then published with an atomic pointer swap. Readers acquire the
+ * current snapshot without ever blocking and release it when they are done.
+ * A replaced snapshot is freed only once every reader that may still be using
+ * it has released it. A file that cannot be opened, fails to parse or that
+ * there is no memory to load is reported through the error handler and the
+ * previous snapshot stays in place.
+ *
+ * opts_reload_t* cfg = opts_reload_start(Options, NULL, "/etc/app.conf");
+ * ...
+ * opts_snapshot_t snap = opts_reload_acquire(cfg);
+ * threads = opts_ctx_get_value(snap.ctx, "threads", NULL);
+ * opts_reload_release(cfg, snap);
+ *
+ * On Linux the file is watched with inotify from a background thread. On other
+ * platforms opts_reload_now must be called to pick up changes.
+ */
+#ifndef OPTS_RELOAD_H
+#define OPTS_RELOAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "opts.h"
+
+/** A configuration file that is reloaded whenever it changes */
+typedef struct opts_reload_t opts_reload_t;
+
+/** A reference to the snapshot that was current when it was acquired */
+typedef struct {
+    /** The parsed options, or NULL if the file has never parsed cleanly */
+    const opts_ctx_t* ctx;
+    /* For internal use only */
+    unsigned long epoch;
+} opts_snapshot_t;
+
+/**
+ * Loads the given file and starts watching it for changes.
+ *
+ * @param opts   The option definitions to parse the file against. These must
+ *               remain valid until opts_reload_stop is called.
+ * @param err_cb The error handler to use, or NULL to print errors to stderr.
+ *               Unlike the default handler of opts_parse this does not exit.
+ * @param path   The path of the configuration file.
+ *
+ * @return The new reloader, or NULL if there was no memory for it.
+ */
+opts_reload_t* opts_reload_start(opts_cfg_t* opts, opts_err_cbfn_t err_cb,
+                                 const char* path);
+
+/**
+ * Stops watching the file and frees the reloader and its snapshot. No
+ * snapshots may be held when this is called.
+ *
+ * @param reload The reloader to stop.
+ */
+void opts_reload_stop(opts_reload_t* reload);
+
+/**
+ * Reads and parses the file immediately, publishing the result if it parsed
+ * without errors. This blocks until any snapshot it replaces has been
+ * released.
+ *
+ * @param reload The reloader to refresh.
+ *
+ * @return true if a new snapshot was published, false otherwise.
+ */
+bool opts_reload_now(opts_reload_t* reload);
+
+/**
+ * Acquires the current snapshot. This never blocks. The snapshot remains
+ * valid, and unchanged, until it is released.
+ *
+ * @param reload The reloader to read from.
+ *
+ * @return The current snapshot.
+ */
+opts_snapshot_t opts_reload_acquire(opts_reload_t* reload);
+
+/**
+ * Releases a snapshot acquired with opts_reload_acquire.
+ *
+ * @param reload   The reloader the snapshot was acquired from.
+ * @param snapshot The snapshot to release.
+ */
+void opts_reload_release(opts_reload_t* reload, opts_snapshot_t snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,25 +5,104 @@
   $HeadURL$
   */
 #include "atf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
 
-char* Curr_Test = NULL;
+const char* Curr_Test = NULL;
 static unsigned int Total = 0;
 static unsigned int Failed = 0;
 
+#define BENCH_SAMPLES     101
+#define BENCH_MIN_SAMPLES 11
+#define BENCH_SAMPLE_NS   100000u
+#define BENCH_WARMUP_NS   20000000u
+#define BENCH_BUDGET_NS   500000000u
+#define BENCH_MAX_RESULTS 256
+
+typedef struct {
+    char name[128];
+    double median_ns;
+} result_t;
+
+static struct {
+    const char* file;
+    int line;
+    uint64_t batch;
+    uint64_t count;
+    uint64_t started;
+    uint64_t warmup_end;
+    uint64_t deadline;
+    size_t num_samples;
+    double samples[BENCH_SAMPLES];
+} Bench;
+
+static int Baseline_Loaded = 0;
+static size_t Num_Results = 0;
+static result_t Results[BENCH_MAX_RESULTS];
+
+static uint64_t atf_clock(void);
+static void atf_bench_report(void);
+static result_t* atf_bench_result(const char* name, int add);
+static void atf_bench_load(void);
+static void atf_bench_save(void);
+static const char* atf_bench_env(const char* name);
+static int atf_compare(const void* a, const void* b);
+
 void atf_run_suite(suite_t suite) {
     suite();
 }
 
-void atf_test_start(char* p_test_name) {
+void atf_test_start(const char* p_test_name) {
     Curr_Test = p_test_name;
     Total++;
 }
 
-void atf_test_fail(char* expr, char* file, int line) {
+void atf_test_fail(const char* expr, const char* file, int line) {
     Failed++;
     printf("%s:%d:0:%s:FAIL\n\t%s\n", file, line, Curr_Test, expr); \
 }
 
+void atf_bench_start(const char* p_bench_name, const char* file, int line) {
+    atf_test_start(p_bench_name);
+    Bench.file        = file;
+    Bench.line        = line;
+    Bench.batch       = 1;
+    Bench.count       = 0;
+    Bench.started     = 0;
+    Bench.num_samples = 0;
+}
+
+/* Called before every run of the body. The first call only starts the clock,
+ * later ones close a batch once enough runs have gone by. Batches are doubled
+ * until one takes long enough to time accurately, and are thrown away until
+ * the warm-up is over. */
+int atf_bench_next(void) {
+    uint64_t now;
+    if (0 == Bench.started) {
+        Bench.started    = atf_clock();
+        Bench.warmup_end = Bench.started + BENCH_WARMUP_NS;
+        Bench.deadline   = Bench.warmup_end + BENCH_BUDGET_NS;
+        return 1;
+    }
+    if (++Bench.count < Bench.batch)
+        return 1;
+    now = atf_clock();
+    if (now - Bench.started < BENCH_SAMPLE_NS)
+        Bench.batch *= 2;
+    else if (now >= Bench.warmup_end)
+        Bench.samples[Bench.num_samples++] = (double)(now - Bench.started) / (double)Bench.batch;
+    if ((BENCH_SAMPLES == Bench.num_samples) ||
+        ((now >= Bench.deadline) && (Bench.num_samples >= BENCH_MIN_SAMPLES))) {
+        atf_bench_report();
+        return 0;
+    }
+    Bench.count   = 0;
+    Bench.started = atf_clock();
+    return 1;
+}
+
 int atf_print_results(void) {
     static const char* results_string =
     "\nUnit Test Summary"
@@ -32,7 +111,95 @@ int atf_print_results(void) {
     "\nPassed: %d"
     "\nFailed: %d"
     "\n\n";
+    atf_bench_save();
     printf(results_string, Total, Total - Failed, Failed);
     return Failed;
 }
 
+static uint64_t atf_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void atf_bench_report(void) {
+    size_t count = Bench.num_samples;
+    double median, p99, threshold;
+    const char* env;
+    result_t* base;
+    qsort(Bench.samples, count, sizeof(double), &atf_compare);
+    median = Bench.samples[count / 2];
+    p99    = Bench.samples[(count * 99) / 100];
+    printf("%s: median %.1f ns, p99 %.1f ns, %.0f ops/sec\n",
+           Curr_Test, median, p99, (median > 0) ? 1e9 / median : 0.0);
+
+    atf_bench_load();
+    if (NULL != atf_bench_env("ATF_BENCH_UPDATE")) {
+        if (NULL != (base = atf_bench_result(Curr_Test, 1)))
+            base->median_ns = median;
+    } else if (NULL != (base = atf_bench_result(Curr_Test, 0))) {
+        env       = atf_bench_env("ATF_BENCH_THRESHOLD");
+        threshold = (NULL != env) ? atof(env) : 25.0;
+        if (median > base->median_ns * (1.0 + threshold / 100.0)) {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "median of %.1f ns is %.0f%% slower than the baseline of %.1f ns",
+                     median, 100.0 * (median / base->median_ns - 1.0), base->median_ns);
+            atf_test_fail(msg, Bench.file, Bench.line);
+        }
+    }
+}
+
+static result_t* atf_bench_result(const char* name, int add) {
+    size_t i;
+    for (i = 0; i < Num_Results; i++)
+        if (0 == strcmp(Results[i].name, name))
+            return &Results[i];
+    if (!add || (Num_Results == BENCH_MAX_RESULTS) || (strlen(name) >= sizeof(Results[0].name)))
+        return NULL;
+    strcpy(Results[Num_Results].name, name);
+    return &Results[Num_Results++];
+}
+
+/* The baseline file holds one benchmark per line, its median in nanoseconds
+ * followed by its name */
+static void atf_bench_load(void) {
+    const char* path = atf_bench_env("ATF_BENCH_BASELINE");
+    FILE* file;
+    char line[256];
+    if (Baseline_Loaded || (NULL == path) || (NULL == (file = fopen(path, "r"))))
+        return;
+    Baseline_Loaded = 1;
+    while (NULL != fgets(line, sizeof(line), file)) {
+        char* name = NULL;
+        double median = strtod(line, &name);
+        result_t* result;
+        name += strspn(name, " \t");
+        name[strcspn(name, "\n")] = '\0';
+        if (('\0' != *name) && (NULL != (result = atf_bench_result(name, 1))))
+            result->median_ns = median;
+    }
+    fclose(file);
+}
+
+static void atf_bench_save(void) {
+    const char* path = atf_bench_env("ATF_BENCH_BASELINE");
+    FILE* file;
+    size_t i;
+    if ((NULL == path) || (NULL == atf_bench_env("ATF_BENCH_UPDATE")) || (NULL == (file = fopen(path, "w"))))
+        return;
+    for (i = 0; i < Num_Results; i++)
+        fprintf(file, "%.1f %s\n", Results[i].median_ns, Results[i].name);
+    fclose(file);
+}
+
+/* Variables that are set but empty count as unset, so the Makefile can pass
+ * them along unconditionally */
+static const char* atf_bench_env(const char* name) {
+    const char* value = getenv(name);
+    return ((NULL != value) && ('\0' != *value)) ? value : NULL;
+}
+
+static int atf_compare(const void* a, const void* b) {
+    double lhs = *(const double*)a, rhs = *(const double*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
@@ -9,6 +9,10 @@
 
 #include <stdio.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define CHECK(expr) \
     if (!(expr)) { atf_test_fail(#expr,__FILE__,__LINE__); break; }
 
@@ -17,6 +21,14 @@
 #define TEST(desc) \
     for(atf_test_start(#desc); Curr_Test != NULL; Curr_Test = NULL)
 
+/* Runs the body repeatedly and reports how long one run takes. The runs are
+ * timed in batches sized during a warm-up so the clock is read rarely. When
+ * ATF_BENCH_BASELINE names a file of earlier results, a median more than
+ * ATF_BENCH_THRESHOLD percent (default 25) slower than it fails the benchmark.
+ * Setting ATF_BENCH_UPDATE records the new results in that file instead. */
+#define BENCH(desc) \
+    for(atf_bench_start(#desc,__FILE__,__LINE__); atf_bench_next(); )
+
 #define RUN_EXTERN_TEST_SUITE(name) \
     do { extern TEST_SUITE(name); atf_run_suite(&name); } while(0)
 
@@ -27,14 +39,22 @@
 
 typedef void (*suite_t)(void);
 
-extern char* Curr_Test;
+extern const char* Curr_Test;
 
 void atf_run_suite(suite_t suite);
 
-void atf_test_start(char* p_test_name);
+void atf_test_start(const char* p_test_name);
+
+void atf_test_fail(const char* expr, const char* file, int line);
 
-void atf_test_fail(char* expr, char* file, int line);
+void atf_bench_start(const char* p_bench_name, const char* file, int line);
+
+int atf_bench_next(void);
 
 int atf_print_results(void);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* TEST_H */
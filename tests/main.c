@@ -6,5 +6,7 @@ int main(int argc, char** argv)
     (void)argv;
     RUN_EXTERN_TEST_SUITE(Opts);
     RUN_EXTERN_TEST_SUITE(Arg);
+    RUN_EXTERN_TEST_SUITE(OptsCpp);
+    RUN_EXTERN_TEST_SUITE(Reload);
     return PRINT_TEST_RESULTS();
 }
@@ -181,4 +181,103 @@ TEST_SUITE(Arg) {
         CHECK(0 == strcmp("-",argv[0]));
     }
 #endif
+
+    //-------------------------------------------------------------------------
+    // GNU Style Permutation
+    //-------------------------------------------------------------------------
+    TEST(OPTBEGIN_GNU should parse options after positional arguments)
+    {
+        char* args[] = { "prog", "file", "-a", "-b", "foo", "other", "-cbar", NULL };
+        bool a = false;
+        argc = 7, argv = args;
+        OPTBEGIN_GNU {
+            case 'a': a = true; break;
+            case 'b': CHECK(0 == strcmp("foo", OPTARG())); break;
+            case 'c': CHECK(0 == strcmp("bar", EOPTARG(dummy()))); break;
+            default:  CHECK(false);
+        } OPTEND;
+        CHECK(a);
+        CHECK(0 == strcmp("prog", ARGV0));
+        CHECK(2 == argc);
+        CHECK(0 == strcmp("file", argv[0]));
+        CHECK(0 == strcmp("other", argv[1]));
+        CHECK(NULL == argv[2]);
+    }
+
+    TEST(OPTBEGIN_GNU should treat everything after a -- as positional)
+    {
+        char* args[] = { "prog", "x", "-a", "--", "-b", "y", NULL };
+        int count = 0;
+        argc = 6, argv = args;
+        OPTBEGIN_GNU {
+            case 'a': count++; break;
+            default:  CHECK(false);
+        } OPTEND;
+        CHECK((1 == count) && (3 == argc));
+        CHECK(0 == strcmp("x", argv[0]));
+        CHECK(0 == strcmp("-b", argv[1]));
+        CHECK(0 == strcmp("y", argv[2]));
+        CHECK(NULL == argv[3]);
+    }
+
+    TEST(OPTBEGIN_GNU should keep - as a positional argument)
+    {
+        char* args[] = { "prog", "-", "--foo", NULL };
+        argc = 3, argv = args;
+        OPTBEGIN_GNU {
+            case '-': CHECK(0 == strcmp("foo", OPTARG())); break;
+            default:  CHECK(false);
+        } OPTEND;
+        CHECK((1 == argc) && (0 == strcmp("-", argv[0])) && (NULL == argv[1]));
+    }
+
+    TEST(OPTBEGIN_GNU should abort when the last option has no argument)
+    {
+        char* args[] = { "prog", "file", "-b", NULL };
+        Aborted = false;
+        argc = 3, argv = args;
+        OPTBEGIN_GNU {
+            case 'b': (void)EOPTARG(dummy()); break;
+            default:  CHECK(false);
+        } OPTEND;
+        CHECK(Aborted);
+        CHECK((1 == argc) && (0 == strcmp("file", argv[0])));
+    }
+
+    TEST(OPTBEGIN_GNU should compact a large vector in order)
+    {
+        static char* args[100002];
+        static char* names[] = { "a", "b", "c", "d" };
+        int i, count = 0;
+        bool ordered = true;
+        args[0] = "prog";
+        for (i = 1; i <= 100000; i++)
+            args[i] = (i % 2) ? "-a" : names[(i / 2) % 4];
+        args[100001] = NULL;
+        argc = 100001, argv = args;
+        OPTBEGIN_GNU {
+            case 'a': count++; break;
+            default:  CHECK(false);
+        } OPTEND;
+        for (i = 0; i < argc; i++)
+            ordered = ordered && (argv[i] == names[(i + 1) % 4]);
+        CHECK((50000 == count) && (50000 == argc) && ordered && (NULL == argv[argc]));
+    }
+
+    //-------------------------------------------------------------------------
+    // Benchmarks
+    //-------------------------------------------------------------------------
+    BENCH(Option processing of a typical command line)
+    {
+        char* args[] = { "prog", "-a", "-bfoo", "-c", "bar", "--long", "in1.c", "-ab", "in2.c", "--", "-x", NULL };
+        int count = 0;
+        argc = 11, argv = args;
+        OPTBEGIN {
+            case 'b': count += (NULL != OPTARG()); break;
+            case 'c': count += (NULL != OPTARG()); break;
+            case '-': count += (NULL != OPTARG()); break;
+            default:  count++;
+        } OPTEND;
+        CHECK((4 == count) && (0 == strcmp("in1.c", argv[0])));
+    }
 }
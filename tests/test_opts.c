@@ -5,6 +5,7 @@
 #include <string.h>
 #include <setjmp.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 // File To Test
 #include "opts.h"
@@ -14,7 +15,7 @@
 //-----------------------------------------------------------------------------
 opts_cfg_t Options_Config[] = {
     { "a",   false, "test_a", "A simple test option" },
-    { "b",   true,  "test_b", "A simple test option" },
+    { "b",   true,  "test_b", "A simple test option", NULL, true },
     { "c",   false, "test_c", "A simple test option" },
     { "foo", false, "opttag", "A simple test option" },
     { "bar", true,  "test_e", "A simple test option" },
@@ -22,6 +23,47 @@ opts_cfg_t Options_Config[] = {
     { NULL,  false, NULL,     NULL }
 };
 
+static const char* Mode_Values[] = { "fast", "safe", "debug", NULL };
+static const opts_constraint_t Mode_Constraint  = { OPTS_ENUM,  Mode_Values, 0, 0, 0 };
+static const opts_constraint_t Port_Constraint  = { OPTS_RANGE, NULL, 1, 65535, 0 };
+static const opts_constraint_t Ident_Constraint = { OPTS_CLASS, NULL, 0, 0, OPTS_IDENT };
+
+opts_cfg_t Constrained_Config[] = {
+    { "mode", true, "cfg", "An enumerated option", &Mode_Constraint },
+    { "port", true, "cfg", "A ranged option",      &Port_Constraint },
+    { "name", true, "cfg", "A restricted option",  &Ident_Constraint },
+    { NULL,   false, NULL, NULL, NULL }
+};
+
+opts_cfg_t List_Config[] = {
+    { "hosts", true,  "net", "A list option",   NULL, false, ',' },
+    { "D",     true,  "def", "A list of pairs", NULL, false, ',', true },
+    { NULL,    false, NULL,  NULL,              NULL }
+};
+
+opts_cfg_t Alias_Config[] = {
+    { "verbose", false, "out", "Print more",  NULL },
+    { "v",       false, NULL,  NULL,          NULL, false, '\0', false, "verbose" },
+    { "o",       false, NULL,  NULL,          NULL, false, '\0', false, "output" },
+    { "output",  true,  "out", "Output file", NULL },
+    { NULL,      false, NULL,  NULL,          NULL }
+};
+
+static const opts_rule_t Tls_Rules[]   = { { OPTS_REQUIRES,  "cert", NULL  }, { 0, NULL, NULL } };
+static const opts_rule_t Quiet_Rules[] = { { OPTS_CONFLICTS, NULL,   "log" }, { 0, NULL, NULL } };
+static const opts_rule_t Mode_Rules[]  = { { OPTS_EXACTLY_ONE, NULL, "mode" }, { 0, NULL, NULL } };
+
+opts_cfg_t Rules_Config[] = {
+    { "tls",     false, "net",  "Use TLS",       NULL, false, '\0', false, NULL, Tls_Rules },
+    { "cert",    true,  "net",  "Certificate",   NULL },
+    { "quiet",   false, NULL,   "Print nothing", NULL, false, '\0', false, NULL, Quiet_Rules },
+    { "verbose", false, "log",  "Print more",    NULL },
+    { "trace",   false, "log",  "Print all",     NULL },
+    { "fast",    false, "mode", "Run fast",      NULL },
+    { "safe",    false, "mode", "Run safely",    NULL },
+    { NULL,      false, NULL,   NULL,            NULL, false, '\0', false, NULL, Mode_Rules }
+};
+
 //-----------------------------------------------------------------------------
 // Global Test Variables
 //-----------------------------------------------------------------------------
@@ -46,6 +88,89 @@ static void User_Error_Cb(const char* msg, char* opt_name) {
     exit(2);
 }
 
+static char Error_Log[256];
+
+static void Logging_Error_Cb(const char* msg, char* opt_name) {
+    size_t used = strlen(Error_Log);
+    snprintf(&Error_Log[used], sizeof(Error_Log) - used, "%s:%c;", opt_name, msg[0]);
+}
+
+static size_t Error_Count;
+
+static void Counting_Error_Cb(const char* msg, char* opt_name) {
+    (void)msg;
+    (void)opt_name;
+    Error_Count++;
+}
+
+/* Whether two null terminated arrays hold the same strings in the same order */
+static bool Same_Strings(const char** expect, const char** actual) {
+    size_t i;
+    if ((NULL == expect) || (NULL == actual))
+        return false;
+    for (i = 0; (NULL != expect[i]) && (NULL != actual[i]); i++)
+        if (0 != strcmp(expect[i], actual[i]))
+            return false;
+    return (NULL == expect[i]) && (NULL == actual[i]);
+}
+
+static const char* Intern_Values[] = { "queue1", "queue2", "/tmp/a", "/tmp/b", "latest" };
+
+typedef struct {
+    opts_intern_t* table;
+    const char* interned[5];
+} intern_job_t;
+
+static void* Intern_Thread(void* arg) {
+    intern_job_t* job = (intern_job_t*)arg;
+    size_t i, round;
+    for (round = 0; round < 1000; round++) {
+        for (i = 0; i < 5; i++) {
+            char copy[16];
+            const char* interned;
+            strcpy(copy, Intern_Values[i]);
+            interned = opts_intern(job->table, copy);
+            if (0 == round)
+                job->interned[i] = interned;
+            else if (interned != job->interned[i])
+                job->interned[i] = NULL;
+        }
+    }
+    return NULL;
+}
+
+typedef struct {
+    int count;
+    const char* values[8];
+    int indexes[8];
+} stream_log_t;
+
+static void Stream_Option_Cb(void* user, opts_cfg_t* opt, const char* value, size_t length, int index) {
+    stream_log_t* log = (stream_log_t*)user;
+    (void)opt;
+    if ((log->count < 8) && (strlen(value) == length)) {
+        log->values[log->count]  = value;
+        log->indexes[log->count] = index;
+    }
+    log->count++;
+}
+
+static const char* Complete(opts_cfg_t* opts, int argc, char** argv, int cursor) {
+    static char output[1024];
+    FILE* file = tmpfile();
+    size_t length;
+    opts_complete( file, opts, argc, argv, cursor );
+    rewind( file );
+    length = fread( output, 1, sizeof(output) - 1, file );
+    output[length] = '\0';
+    fclose( file );
+    return output;
+}
+
+static void Stream_Argument_Cb(void* user, const char* arg, int index) {
+    Stream_Option_Cb(user, NULL, arg, strlen(arg), index);
+}
+
 void test_setup(void) {}
 
 //-----------------------------------------------------------------------------
@@ -199,6 +324,19 @@ TEST_SUITE(Opts) {
     }
 
 
+    TEST(Verify_ParseOptions_returns_values_that_point_into_argv)
+    {
+        char* args[] = { "prog", "--bar=baz", "-b", "foo", "-a" };
+        CHECK_DOES_NOT_EXIT()
+        {
+            opts_parse( Options_Config, NULL, 5, args );
+            CHECK(args[1] + 6 == opts_get_value("bar", NULL));
+            CHECK(args[3] == opts_get_value("b", NULL));
+            CHECK(Options_Config[0].name == opts_get_value("a", NULL));
+        }
+        opts_reset();
+    }
+
     TEST(Verify_ParseOptions_Parses_a_short_option_with_a_missing_param)
     {
         int exit_code = 0;
@@ -303,7 +441,6 @@ TEST_SUITE(Opts) {
             const char** opts = opts_select("c", NULL);
             CHECK(0 == strcmp("c", opts[0]));
             CHECK(NULL == opts[1]);
-            free(opts);
         }
         opts_reset();
     }
@@ -317,7 +454,6 @@ TEST_SUITE(Opts) {
             const char** opts = opts_select(NULL, "test_c");
             CHECK(0 == strcmp("c", opts[0]));
             CHECK(NULL == opts[1]);
-            free(opts);
         }
         opts_reset();
     }
@@ -331,7 +467,6 @@ TEST_SUITE(Opts) {
             const char** opts = opts_select("baz", "opttag");
             CHECK(0 == strcmp("baz", opts[0]));
             CHECK(NULL == opts[1]);
-            free(opts);
         }
         opts_reset();
     }
@@ -346,8 +481,806 @@ TEST_SUITE(Opts) {
             CHECK(0 == strcmp("baz", opts[0]));
             CHECK(0 == strcmp("foo", opts[1]));
             CHECK(NULL == opts[2]);
-            free(opts);
         }
         opts_reset();
     }
+
+    TEST(Verify_Select_returns_every_occurrence_of_a_repeated_option)
+    {
+        char* args[101] = { "prog" };
+        int i;
+        for (i = 1; i < 101; i++)
+            args[i] = (i % 2) ? "-b" : ((i % 4) ? "x" : "y");
+        CHECK_DOES_NOT_EXIT()
+        {
+            opts_parse( Options_Config, NULL, 101, args );
+            const char** opts = opts_select("b", NULL);
+            for (i = 0; i < 50; i++)
+                CHECK(0 == strcmp((i % 2) ? "x" : "y", opts[i]));
+            CHECK(NULL == opts[50]);
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_Iter_visits_options_and_arguments_in_command_line_order)
+    {
+        char* args[] = { "prog", "x.o", "-b", "m", "y.o", "--bar=z", "-a", "-b", "c" };
+        const char* expect[] = { "x.o", "m", "y.o", "c" };
+        int index[] = { 1, 2, 4, 7 };
+        int i = 0;
+        opts_iter_t it;
+        CHECK_DOES_NOT_EXIT()
+        {
+            opts_parse( Options_Config, NULL, 9, args );
+            opts_iter_begin(&it, "b", NULL, true);
+            while (opts_iter_next(&it)) {
+                CHECK(i < 4);
+                CHECK(0 == strcmp(expect[i], it.value));
+                CHECK(strlen(expect[i]) == it.length);
+                CHECK(index[i] == it.index);
+                CHECK((1 == i || 3 == i) == (&Options_Config[1] == it.option));
+                i++;
+            }
+            CHECK(4 == i);
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_Iter_visits_only_options_matching_the_tag)
+    {
+        char* args[] = { "prog", "--baz", "x.o", "-a", "--foo" };
+        opts_iter_t it;
+        CHECK_DOES_NOT_EXIT()
+        {
+            opts_parse( Options_Config, NULL, 5, args );
+            opts_iter_begin(&it, NULL, "opttag", false);
+            CHECK(opts_iter_next(&it));
+            CHECK(0 == strcmp("baz", it.value));
+            CHECK(opts_iter_next(&it));
+            CHECK(0 == strcmp("foo", it.value));
+            CHECK(!opts_iter_next(&it));
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_ParseStream_reports_entries_in_order_without_storing_them)
+    {
+        char* args[] = { "prog", "x.o", "-ab", "m", "--bar=z" };
+        stream_log_t log = { 0 };
+        CHECK_DOES_NOT_EXIT()
+        {
+            opts_parse_stream( Options_Config, NULL, 5, args, Stream_Option_Cb, Stream_Argument_Cb, &log );
+            CHECK(4 == log.count);
+            CHECK(args[1] == log.values[0]);
+            CHECK(0 == strcmp("a", log.values[1]));
+            CHECK(args[3] == log.values[2]);
+            CHECK(args[4] + 6 == log.values[3]);
+            CHECK(1 == log.indexes[0]);
+            CHECK(2 == log.indexes[1]);
+            CHECK(2 == log.indexes[2]);
+            CHECK(4 == log.indexes[3]);
+            CHECK(!opts_is_set(NULL, NULL));
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_CtxParseStream_reuses_the_lookup_tables_of_the_context)
+    {
+        char* args[] = { "prog", "x.o", "-ab", "m", "--bar=z" };
+        stream_log_t log1 = { 0 };
+        stream_log_t log2 = { 0 };
+        opts_ctx_t* ctx = opts_ctx_new();
+        CHECK(opts_ctx_parse_stream( ctx, Options_Config, NULL, 5, args, Stream_Option_Cb, Stream_Argument_Cb, &log1 ));
+        CHECK(opts_ctx_parse_stream( ctx, Options_Config, NULL, 5, args, Stream_Option_Cb, Stream_Argument_Cb, &log2 ));
+        CHECK(4 == log1.count);
+        CHECK(4 == log2.count);
+        CHECK(args[4] + 6 == log2.values[3]);
+        CHECK(!opts_ctx_is_set(ctx, NULL, NULL));
+        opts_ctx_free(ctx);
+    }
+
+    TEST(Verify_Constraints_resolve_enum_values_to_their_ordinals)
+    {
+        char* args[] = { "prog", "--mode=debug", "--port", "8080", "--name=a_b-c" };
+        CHECK_DOES_NOT_EXIT()
+        {
+            opts_parse( Constrained_Config, NULL, 5, args );
+            CHECK(2 == opts_get_ordinal("mode", NULL));
+            CHECK(8080 == opts_get_ordinal("port", NULL));
+            CHECK(-1 == opts_get_ordinal("name", NULL));
+            CHECK(opts_equal("name", NULL, "a_b-c"));
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_Constraints_reject_a_value_not_in_the_enum)
+    {
+        char* args[] = { "prog", "--mode=fastest" };
+        int exit_code = setjmp( Exit_Point );
+        if( 0 == exit_code ) {
+            opts_parse( Constrained_Config, NULL, 2, args );
+            CHECK( false );
+        } else {
+            CHECK( 0 != exit_code );
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_Constraints_reject_a_value_out_of_range)
+    {
+        char* args[] = { "prog", "--port=65536" };
+        int exit_code = setjmp( Exit_Point );
+        if( 0 == exit_code ) {
+            opts_parse( Constrained_Config, NULL, 2, args );
+            CHECK( false );
+        } else {
+            CHECK( 0 != exit_code );
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_Constraints_reject_a_value_with_disallowed_characters)
+    {
+        char* args[] = { "prog", "--name=a/b" };
+        int exit_code = setjmp( Exit_Point );
+        if( 0 == exit_code ) {
+            opts_parse( Constrained_Config, NULL, 2, args );
+            CHECK( false );
+        } else {
+            CHECK( 0 != exit_code );
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_Complete_lists_matching_options_with_descriptions)
+    {
+        char* args[] = { "prog", "-a", "--ba" };
+        CHECK(0 == strcmp("--bar\tA simple test option\n--baz\tA simple test option\n",
+                          Complete(Options_Config, 3, args, 2)));
+        CHECK(0 == strcmp("-b\tA simple test option\n", Complete(Options_Config, 2, (char*[]){ "prog", "-b" }, 1)));
+        CHECK(0 == strcmp("", Complete(Options_Config, 2, (char*[]){ "prog", "--q" }, 1)));
+        CHECK(NULL != strstr(Complete(Options_Config, 2, (char*[]){ "prog", "-" }, 1), "-a\t"));
+        CHECK(NULL != strstr(Complete(Options_Config, 2, (char*[]){ "prog", "-" }, 1), "--foo\t"));
+    }
+
+    TEST(Verify_Complete_lists_enum_values_for_a_pending_option)
+    {
+        char* args[] = { "prog", "--mode", "d" };
+        char* joined[] = { "prog", "--mode=", "x" };
+        char* split[] = { "prog", "--mode", "=", "s" };
+        CHECK(0 == strcmp("debug\n", Complete(Constrained_Config, 3, args, 2)));
+        CHECK(0 == strcmp("--mode=fast\n--mode=safe\n--mode=debug\n", Complete(Constrained_Config, 3, joined, 1)));
+        CHECK(0 == strcmp("=fast\n=safe\n=debug\n", Complete(Constrained_Config, 3, split, 2)));
+        CHECK(0 == strcmp("safe\n", Complete(Constrained_Config, 4, split, 3)));
+        CHECK(0 == strcmp("", Complete(Constrained_Config, 3, (char*[]){ "prog", "--port", "" }, 2)));
+    }
+
+    TEST(Verify_Complete_leaves_positional_arguments_to_the_shell)
+    {
+        char* args[] = { "prog", "-a", "--", "-" };
+        CHECK(0 == strcmp("", Complete(Options_Config, 4, args, 3)));
+        CHECK(0 == strcmp("", Complete(Options_Config, 2, (char*[]){ "prog", "fi" }, 1)));
+        CHECK(0 == strcmp("", Complete(Options_Config, 3, (char*[]){ "prog", "-ba", "" }, 2)));
+        CHECK(0 == strcmp("", Complete(Options_Config, 3, args, 3)));
+    }
+
+    TEST(Verify_CompleteScript_supports_bash_zsh_and_fish)
+    {
+        FILE* file = tmpfile();
+        CHECK(opts_complete_script(file, "bash", "/usr/bin/my-tool"));
+        CHECK(opts_complete_script(file, "zsh", "my-tool"));
+        CHECK(opts_complete_script(file, "fish", "my-tool"));
+        CHECK(!opts_complete_script(file, "csh", "my-tool"));
+        fclose(file);
+    }
+
+    TEST(Verify_Metrics_count_parse_and_query_work_when_enabled)
+    {
+        char* args[] = { "prog", "-a", "--bar=x", "y" };
+        opts_metrics_t metrics;
+        FILE* file = tmpfile();
+        char line[128];
+        opts_metrics_reset();
+        CHECK_DOES_NOT_EXIT()
+        {
+            opts_parse( Options_Config, NULL, 4, args );
+            CHECK(opts_is_set("a", NULL));
+            CHECK(opts_equal("bar", NULL, "x"));
+        }
+        opts_reset();
+        metrics = opts_metrics();
+#ifdef OPTS_METRICS
+        CHECK(10 == metrics.chars);
+        CHECK(4 <= metrics.lookups);
+        CHECK(0 < metrics.allocations);
+        CHECK(1 == metrics.queries.is_set);
+        CHECK(1 == metrics.queries.equal);
+        CHECK(0 == metrics.queries.select);
+#else
+        CHECK(0 == metrics.chars);
+        CHECK(0 == metrics.queries.is_set);
+#endif
+        opts_metrics_dump(file);
+        rewind(file);
+        CHECK(NULL != fgets(line, sizeof(line), file));
+        CHECK(0 == strncmp("opts_chars ", line, 11));
+        fclose(file);
+    }
+
+    TEST(Verify_ParseString_splits_words_in_place_using_shell_quoting)
+    {
+        char line[] = "  run --bar \"a b\" -a 'c d'\\ e f\\\"g \"x\\$y\\z\" ''";
+        const char** args;
+        CHECK_DOES_NOT_EXIT()
+        {
+            opts_parse_string( Options_Config, NULL, line );
+            CHECK(0 == strcmp("run", opts_prog_name()));
+            CHECK(opts_equal("bar", NULL, "a b"));
+            CHECK(opts_get_value("bar", NULL) > line && opts_get_value("bar", NULL) < line + sizeof(line));
+            CHECK(opts_is_set("a", NULL));
+            args = opts_arguments();
+            CHECK(NULL != args[0] && 0 == strcmp("", args[0]));
+            CHECK(NULL != args[1] && 0 == strcmp("x$y\\z", args[1]));
+            CHECK(NULL != args[2] && 0 == strcmp("f\"g", args[2]));
+            CHECK(NULL != args[3] && 0 == strcmp("c d e", args[3]));
+            CHECK(NULL == args[4]);
+            free(args);
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_ParseString_takes_option_values_from_the_next_word)
+    {
+        char line[] = "prog -b 'x y' z";
+        opts_ctx_t* ctx = opts_ctx_new();
+        opts_iter_t it;
+        CHECK(opts_ctx_parse_string( ctx, Options_Config, NULL, line ));
+        CHECK(opts_ctx_equal(ctx, "b", NULL, "x y"));
+        opts_ctx_iter_begin(ctx, &it, NULL, NULL, true);
+        CHECK(opts_iter_next(&it) && (1 == it.index) && (3 == it.length));
+        CHECK(opts_iter_next(&it) && (3 == it.index) && (0 == strcmp("z", it.value)));
+        CHECK(!opts_iter_next(&it));
+        opts_ctx_free(ctx);
+    }
+
+    TEST(Verify_ParseString_reports_an_unterminated_quote)
+    {
+        char line[] = "prog \"abc";
+        int exit_code = setjmp( Exit_Point );
+        if( 0 == exit_code ) {
+            opts_parse_string( Options_Config, NULL, line );
+            CHECK( false );
+        } else {
+            CHECK( 0 != exit_code );
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_ParseBuffer_parses_NUL_separated_elements)
+    {
+        static const char cmdline[] = "prog\0--bar\0x\0file\0-a";
+        opts_ctx_t* ctx = opts_ctx_new();
+        const char** args;
+        CHECK(opts_ctx_parse_buffer( ctx, Options_Config, NULL, cmdline, sizeof(cmdline) ));
+        CHECK(0 == strcmp("prog", opts_ctx_prog_name(ctx)));
+        CHECK(opts_ctx_get_value(ctx, "bar", NULL) == cmdline + 11);
+        CHECK(opts_ctx_is_set(ctx, "a", NULL));
+        args = opts_ctx_arguments(ctx);
+        CHECK(args[0] == cmdline + 13);
+        CHECK(NULL == args[1]);
+        free(args);
+
+        /* Reusing the context starts from an empty result */
+        CHECK(opts_ctx_parse_buffer( ctx, Options_Config, NULL, cmdline, 5 ));
+        CHECK(!opts_ctx_is_set(ctx, NULL, NULL));
+        CHECK(opts_ctx_parse_buffer( ctx, Options_Config, NULL, cmdline, 0 ));
+        CHECK(NULL == opts_ctx_prog_name(ctx));
+        opts_ctx_free(ctx);
+    }
+
+    TEST(Verify_ParseBuffer_reports_an_unterminated_element)
+    {
+        static char cmdline[] = "prog\0-a";
+        opts_ctx_t* ctx = opts_ctx_new();
+        int exit_code = setjmp( Exit_Point );
+        if( 0 == exit_code ) {
+            opts_ctx_parse_buffer( ctx, Options_Config, User_Error_Cb, cmdline, sizeof(cmdline) - 1 );
+            CHECK( false );
+        } else {
+            CHECK( 2 == exit_code );
+        }
+        opts_ctx_free(ctx);
+    }
+
+    TEST(Verify_Parse_keeps_only_the_last_occurrence_of_a_single_valued_option)
+    {
+        static char* args[20003] = { "prog" };
+        const char** opts;
+        opts_iter_t it;
+        int i;
+        for (i = 1; i < 20001; i += 2) {
+            args[i]   = "--bar";
+            args[i+1] = (i < 19999) ? "x" : "y";
+        }
+        args[20001] = "-b";
+        args[20002] = "z";
+        CHECK_DOES_NOT_EXIT()
+        {
+            opts_parse( Options_Config, NULL, 20003, args );
+            CHECK(opts_equal("bar", NULL, "y"));
+            opts = opts_select(NULL, NULL);
+            CHECK(0 == strcmp("z", opts[0]));
+            CHECK(0 == strcmp("y", opts[1]));
+            CHECK(NULL == opts[2]);
+            opts_iter_begin(&it, NULL, NULL, false);
+            CHECK(opts_iter_next(&it) && (19999 == it.index));
+            CHECK(opts_iter_next(&it) && (20001 == it.index));
+            CHECK(!opts_iter_next(&it));
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_Select_returns_the_same_array_until_the_next_parse)
+    {
+        char* args[] = { "prog", "-b", "x", "--foo", "-b", "y" };
+        const char** first;
+        CHECK_DOES_NOT_EXIT()
+        {
+            opts_parse( Options_Config, NULL, 6, args );
+            first = opts_select("b", NULL);
+            CHECK(first == opts_select("b", NULL));
+            CHECK(first != opts_select(NULL, "opttag"));
+            CHECK(opts_select("nope", NULL) == opts_select("nope", NULL));
+            CHECK(NULL == opts_select("nope", NULL)[0]);
+            CHECK(0 == strcmp("y", first[0]) && 0 == strcmp("x", first[1]) && NULL == first[2]);
+            opts_parse( Options_Config, NULL, 3, args );
+            first = opts_select("b", NULL);
+            CHECK(0 == strcmp("x", first[0]) && NULL == first[1]);
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_Flags_has_a_bit_for_each_option_without_an_argument)
+    {
+        char* args[] = { "prog", "--baz", "-b", "x", "-c" };
+        const uint64_t* flags;
+        CHECK(!OPTS_FLAG_SET(opts_flags(), 0));
+        CHECK(!OPTS_FLAG_SET(opts_flags(), 1000));
+        CHECK_DOES_NOT_EXIT()
+        {
+            opts_parse( Options_Config, NULL, 5, args );
+            flags = opts_flags();
+            CHECK(0 == opts_flag_bit("a"));
+            CHECK(1 == opts_flag_bit("c"));
+            CHECK(2 == opts_flag_bit("foo"));
+            CHECK(3 == opts_flag_bit("baz"));
+            CHECK(-1 == opts_flag_bit("b"));
+            CHECK(-1 == opts_flag_bit("nope"));
+            CHECK(0xAu == flags[0]);
+            CHECK(OPTS_FLAG_SET(flags, opts_flag_bit("baz")));
+            CHECK(!OPTS_FLAG_SET(flags, opts_flag_bit("a")));
+            opts_parse( Options_Config, NULL, 2, args );
+            CHECK(0x8u == flags[0]);
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_List_splits_values_into_spans_over_argv)
+    {
+        char* args[] = { "prog", "--hosts=a,bb", "-Dk1=v1,k2", "x", "--hosts", "c,,d" };
+        const char* expect[] = { "a", "bb", "c", "", "d" };
+        opts_list_t it;
+        int i = 0;
+        CHECK_DOES_NOT_EXIT()
+        {
+            opts_parse( List_Config, NULL, 6, args );
+            opts_list_begin(&it, "hosts");
+            while (opts_list_next(&it)) {
+                CHECK(i < 5);
+                CHECK(NULL == it.key);
+                CHECK(strlen(expect[i]) == it.length);
+                CHECK(0 == strncmp(expect[i], it.value, it.length));
+                i++;
+            }
+            CHECK(5 == i);
+            opts_list_begin(&it, "hosts");
+            CHECK(opts_list_next(&it) && (args[1] + 8 == it.value));
+            CHECK(0 == strcmp("c,,d", opts_get_value("hosts", NULL)));
+
+            opts_list_begin(&it, "D");
+            CHECK(opts_list_next(&it));
+            CHECK((2 == it.key_length) && (0 == strncmp("k1", it.key, 2)));
+            CHECK((2 == it.length) && (0 == strncmp("v1", it.value, 2)));
+            CHECK(opts_list_next(&it));
+            CHECK((2 == it.key_length) && (0 == strncmp("k2", it.key, 2)));
+            CHECK(NULL == it.value);
+            CHECK(!opts_list_next(&it));
+
+            opts_list_begin(&it, "nope");
+            CHECK(!opts_list_next(&it));
+            opts_parse( List_Config, NULL, 4, args );
+            opts_list_begin(&it, "hosts");
+            CHECK(opts_list_next(&it) && opts_list_next(&it) && !opts_list_next(&it));
+        }
+        opts_reset();
+    }
+
+    TEST(Verify_Parallel_parse_matches_the_sequential_parse)
+    {
+        static char* pattern[] = { "-b", "x", "y", "-ab", "v", "--bar", "--foo", "-ba", "-q", "--bar=w", "-a", "-b" };
+        static char* args[1 + 120] = { "prog" };
+        char sequential[256];
+        unsigned int threads;
+        opts_ctx_t* expect = opts_ctx_new();
+        opts_ctx_t* actual = opts_ctx_new();
+        opts_iter_t it1, it2;
+        int i;
+        for (i = 1; i < 121; i++)
+            args[i] = pattern[(i * 7) % 12];
+
+        Error_Log[0] = '\0';
+        CHECK(!opts_ctx_parse( expect, Options_Config, Logging_Error_Cb, 121, args ));
+        strcpy(sequential, Error_Log);
+        for (threads = 2; threads < 9; threads++) {
+            opts_parallel(16, threads);
+            Error_Log[0] = '\0';
+            CHECK(!opts_ctx_parse( actual, Options_Config, Logging_Error_Cb, 121, args ));
+            CHECK(0 == strcmp(sequential, Error_Log));
+            opts_ctx_iter_begin(expect, &it1, NULL, NULL, true);
+            opts_ctx_iter_begin(actual, &it2, NULL, NULL, true);
+            while (opts_iter_next(&it1)) {
+                CHECK(opts_iter_next(&it2));
+                CHECK((it1.index == it2.index) && (it1.value == it2.value) && (it1.option == it2.option));
+            }
+            CHECK(!opts_iter_next(&it2));
+        }
+        opts_parallel(65536, 0);
+        opts_ctx_free(expect);
+        opts_ctx_free(actual);
+    }
+
+    TEST(Verify_Ctx_init_keeps_the_result_in_the_given_storage)
+    {
+        static union { uint64_t align; char bytes[8192]; } storage;
+        char* args[] = { "prog", "-a", "x", "-b", "1", "--bar=y", "-b2", "z" };
+        char* constrained[] = { "prog", "--mode=safe", "--port", "80" };
+        opts_ctx_t* ctx = opts_ctx_init(storage.bytes, sizeof(storage.bytes));
+        const char** values;
+        const char** args_out;
+        int i;
+        CHECK(NULL != ctx);
+        CHECK(NULL == opts_ctx_init(storage.bytes, 1));
+        /* Every reparse gives back what the previous result and its queries
+         * used, so the storage never runs out */
+        for (i = 0; i < 1000; i++) {
+            CHECK(opts_ctx_parse( ctx, Options_Config, NULL, 8, args ));
+            values   = opts_ctx_select(ctx, "b", NULL);
+            args_out = opts_ctx_arguments(ctx);
+            CHECK((NULL != values) && (NULL != args_out));
+        }
+        CHECK(((char*)values > storage.bytes) && ((char*)values < storage.bytes + sizeof(storage.bytes)));
+        CHECK((0 == strcmp("2", values[0])) && (0 == strcmp("1", values[1])) && (NULL == values[2]));
+        CHECK((0 == strcmp("z", args_out[0])) && (0 == strcmp("x", args_out[1])) && (NULL == args_out[2]));
+        CHECK(opts_ctx_is_set(ctx, "a", NULL));
+        CHECK(0 == strcmp("y", opts_ctx_get_value(ctx, "bar", NULL)));
+
+        CHECK(opts_ctx_parse( ctx, Constrained_Config, NULL, 4, constrained ));
+        CHECK(1 == opts_ctx_get_ordinal(ctx, "mode", NULL));
+        CHECK(80 == opts_ctx_get_ordinal(ctx, "port", NULL));
+        CHECK(!opts_ctx_is_set(ctx, "a", NULL));
+        opts_ctx_free(ctx);
+    }
+
+    TEST(Verify_Ctx_init_reports_running_out_of_storage)
+    {
+        static union { uint64_t align; char bytes[4096]; } storage;
+        static char* args[1 + 200] = { "prog" };
+        size_t size;
+        bool failed = false, passed = false;
+        int i;
+        for (i = 1; i < 201; i++)
+            args[i] = (i % 2) ? "-a" : "x";
+        for (size = 0; size <= sizeof(storage.bytes); size += 64) {
+            opts_ctx_t* ctx = opts_ctx_init(storage.bytes, size);
+            if (NULL == ctx)
+                continue;
+            Error_Log[0] = '\0';
+            if (opts_ctx_parse( ctx, Options_Config, Logging_Error_Cb, 201, args )) {
+                const char** out = opts_ctx_arguments(ctx);
+                passed = true;
+                CHECK(opts_ctx_is_set(ctx, "a", NULL));
+                CHECK((NULL == out) || ((NULL != out[99]) && (NULL == out[100])));
+            } else {
+                failed = true;
+                CHECK(NULL != strstr(Error_Log, ":O;"));
+                (void)opts_ctx_is_set(ctx, "a", NULL);
+                (void)opts_ctx_arguments(ctx);
+            }
+        }
+        CHECK(failed && passed);
+    }
+
+    TEST(Verify_Handles_answer_queries_like_names_and_tags)
+    {
+        char* args1[] = { "prog", "-a", "--bar=x", "--foo", "y", "--baz" };
+        char* args2[] = { "prog", "--bar", "z" };
+        opts_ctx_t* ctx = opts_ctx_new();
+        opts_handle_t bar, opttag;
+        CHECK(opts_ctx_parse( ctx, Options_Config, NULL, 6, args1 ));
+        bar    = opts_ctx_handle(ctx, "bar", NULL);
+        opttag = opts_ctx_handle(ctx, NULL, "opttag");
+        CHECK(0 == opts_ctx_handle(ctx, NULL, NULL));
+        CHECK(OPTS_NO_HANDLE == opts_ctx_handle(ctx, "nope", NULL));
+        CHECK(OPTS_NO_HANDLE == opts_ctx_handle(ctx, "bar", "nope"));
+        CHECK(!opts_ctx_is_set_h(ctx, OPTS_NO_HANDLE));
+        CHECK(NULL == opts_ctx_select_h(ctx, OPTS_NO_HANDLE)[0]);
+        CHECK(opts_ctx_is_set_h(ctx, opts_ctx_handle(ctx, "a", "test_a")));
+        CHECK(!opts_ctx_is_set_h(ctx, opts_ctx_handle(ctx, "a", "opttag")));
+        CHECK(0 == strcmp("x", opts_ctx_get_value_h(ctx, bar)));
+        CHECK(opts_ctx_equal_h(ctx, bar, "x"));
+        CHECK(-1 == opts_ctx_get_ordinal_h(ctx, bar));
+        CHECK(opts_ctx_select_h(ctx, opttag) == opts_ctx_select(ctx, NULL, "opttag"));
+        CHECK(0 == strcmp("baz", opts_ctx_select_h(ctx, opttag)[0]));
+        /* Handles outlive the result they were resolved against */
+        CHECK(opts_ctx_parse( ctx, Options_Config, NULL, 3, args2 ));
+        CHECK(0 == strcmp("z", opts_ctx_get_value_h(ctx, bar)));
+        CHECK(!opts_ctx_is_set_h(ctx, opttag));
+        /* Selecting an unknown name must not hide everything else */
+        CHECK(NULL == opts_ctx_select(ctx, "nope", NULL)[0]);
+        CHECK(NULL != opts_ctx_select(ctx, NULL, NULL)[0]);
+        opts_ctx_free(ctx);
+    }
+
+    TEST(Verify_Aliases_parse_into_the_option_they_name)
+    {
+        char* args[] = { "prog", "-v", "-o", "a.txt", "--verbose", "--output=b.txt", "-ob.bin" };
+        opts_ctx_t* ctx = opts_ctx_new();
+        opts_iter_t it;
+        CHECK(opts_ctx_parse( ctx, Alias_Config, NULL, 7, args ));
+        CHECK(opts_ctx_handle(ctx, "v", NULL) == opts_ctx_handle(ctx, "verbose", NULL));
+        CHECK(opts_ctx_handle(ctx, "o", "out") == opts_ctx_handle(ctx, "output", "out"));
+        CHECK(0 == strcmp("b.bin", opts_ctx_get_value(ctx, "output", NULL)));
+        CHECK(0 == strcmp("b.bin", opts_ctx_get_value_h(ctx, opts_ctx_handle(ctx, "o", NULL))));
+        CHECK(0 == strcmp("verbose", opts_ctx_get_value(ctx, "v", NULL)));
+        CHECK(NULL == opts_ctx_select(ctx, "o", NULL)[1]);
+        CHECK(0 == strcmp("b.bin", opts_ctx_select(ctx, NULL, "out")[0]));
+        CHECK(0 == strcmp("verbose", opts_ctx_select(ctx, NULL, "out")[1]));
+        CHECK(NULL == opts_ctx_select(ctx, NULL, "out")[2]);
+        CHECK(0 == opts_ctx_flag_bit(ctx, "v"));
+        CHECK(-1 == opts_ctx_flag_bit(ctx, "o"));
+        opts_ctx_iter_begin(ctx, &it, NULL, NULL, false);
+        CHECK(opts_iter_next(&it) && (&Alias_Config[0] == it.option));
+        CHECK(opts_iter_next(&it) && (&Alias_Config[3] == it.option) && (0 == strcmp("b.bin", it.value)));
+        CHECK(!opts_iter_next(&it));
+        opts_ctx_free(ctx);
+    }
+
+    TEST(Verify_Rules_accept_a_consistent_command_line)
+    {
+        char* args[] = { "prog", "--tls", "--cert", "a.pem", "--verbose", "--trace", "--fast" };
+        opts_ctx_t* ctx = opts_ctx_new();
+        Error_Log[0] = '\0';
+        CHECK(opts_ctx_parse( ctx, Rules_Config, Logging_Error_Cb, 7, args ));
+        CHECK(0 == strcmp("", Error_Log));
+        opts_ctx_free(ctx);
+    }
+
+    TEST(Verify_Rules_report_each_violation)
+    {
+        char* args1[] = { "prog", "--tls", "--quiet", "--verbose", "--trace" };
+        char* args2[] = { "prog", "--safe", "--fast", "--fast" };
+        opts_ctx_t* ctx = opts_ctx_new();
+        Error_Log[0] = '\0';
+        CHECK(!opts_ctx_parse( ctx, Rules_Config, Logging_Error_Cb, 5, args1 ));
+        CHECK(0 == strcmp("tls:R;verbose:C;trace:C;fast|safe:E;", Error_Log));
+        Error_Log[0] = '\0';
+        CHECK(!opts_ctx_parse( ctx, Rules_Config, Logging_Error_Cb, 4, args2 ));
+        CHECK(0 == strcmp("safe:C;", Error_Log));
+        opts_ctx_free(ctx);
+    }
+
+    TEST(Verify_Rules_are_checked_when_streaming_through_a_context)
+    {
+        char* args[] = { "prog", "--tls", "--quiet", "--verbose", "--trace" };
+        opts_ctx_t* ctx = opts_ctx_new();
+        Error_Log[0] = '\0';
+        CHECK(!opts_ctx_parse_stream( ctx, Rules_Config, Logging_Error_Cb, 5, args, NULL, NULL, NULL ));
+        CHECK(0 == strcmp("tls:R;verbose:C;trace:C;fast|safe:E;", Error_Log));
+        opts_ctx_free(ctx);
+    }
+
+    TEST(Verify_Session_edits_report_the_errors_they_introduce)
+    {
+        opts_session_t* session = opts_session_new(Constrained_Config, Logging_Error_Cb);
+        Error_Log[0] = '\0';
+        CHECK(opts_session_edit(session, OPTS_INSERT, 0, "--mode"));
+        CHECK(0 == strcmp("mode:E;", Error_Log));
+        CHECK(1 == opts_session_errors(session));
+        CHECK(0 == strcmp("mode", opts_session_get_value(session, "mode", NULL)));
+        CHECK(opts_session_edit(session, OPTS_INSERT, 1, "slow"));
+        CHECK(0 == strcmp("mode:E;mode:V;", Error_Log));
+        CHECK(opts_session_edit(session, OPTS_REPLACE, 1, "safe"));
+        CHECK(0 == opts_session_errors(session));
+        CHECK(0 == strcmp("safe", opts_session_get_value(session, "mode", NULL)));
+        CHECK(1 == opts_session_get_ordinal(session, "mode", NULL));
+        CHECK(opts_session_equal(session, "mode", NULL, "safe"));
+        CHECK(opts_session_edit(session, OPTS_INSERT, 0, "--port"));
+        CHECK(0 == strcmp("mode:E;mode:V;port:E;", Error_Log));
+        CHECK(1 == opts_session_errors(session));
+        CHECK(opts_session_edit(session, OPTS_DELETE, 0, NULL));
+        CHECK(0 == opts_session_errors(session));
+        CHECK(!opts_session_edit(session, OPTS_DELETE, 2, NULL));
+        CHECK(!opts_session_edit(session, OPTS_INSERT, 3, "x"));
+        CHECK(!opts_session_is_set(session, "port", NULL));
+        opts_session_free(session);
+    }
+
+    TEST(Verify_Session_matches_a_full_parse_after_every_edit)
+    {
+        const char* tokens[] = { "-a", "-b", "x", "--bar", "--bar=y", "-ab", "-bz", "--foo", "--nope", "-", "w", "-c" };
+        const char* names[]  = { "a", "b", "c", "foo", "bar", "baz" };
+        char* args[64] = { "prog" };
+        size_t argc = 1, i, step, seed = 12345;
+        opts_session_t* session = opts_session_new(Options_Config, NULL);
+        opts_ctx_t* ctx = opts_ctx_new();
+        for (step = 0; step < 2000; step++) {
+            const char** expect_args;
+            const char** actual_args;
+            size_t index, edit;
+            seed  = seed * 1103515245 + 12345;
+            edit  = (argc < 3) ? OPTS_INSERT : ((argc > 60) ? OPTS_DELETE : (seed >> 16) % 3);
+            index = (seed >> 8) % (argc - ((OPTS_INSERT == edit) ? 0 : 1));
+            seed  = seed * 1103515245 + 12345;
+            CHECK(opts_session_edit(session, edit, index, tokens[(seed >> 16) % 12]));
+            if (OPTS_INSERT == edit) {
+                memmove(&args[index + 2], &args[index + 1], (argc - index - 1) * sizeof(char*));
+                argc++;
+            } else if (OPTS_DELETE == edit) {
+                memmove(&args[index + 1], &args[index + 2], (argc - index - 2) * sizeof(char*));
+                argc--;
+            }
+            if (OPTS_DELETE != edit)
+                args[index + 1] = (char*)tokens[(seed >> 16) % 12];
+
+            Error_Count = 0;
+            (void)opts_ctx_parse( ctx, Options_Config, Counting_Error_Cb, (int)argc, args );
+            CHECK(Error_Count == opts_session_errors(session));
+            for (i = 0; i < 7; i++) {
+                const char* name   = (6 == i) ? NULL : names[i];
+                const char* tag    = (6 == i) ? "opttag" : NULL;
+                const char* expect = opts_ctx_get_value(ctx, name, tag);
+                const char* actual = opts_session_get_value(session, name, tag);
+                CHECK(opts_ctx_is_set(ctx, name, tag) == opts_session_is_set(session, name, tag));
+                CHECK((NULL == expect) == (NULL == actual));
+                CHECK((NULL == expect) || (0 == strcmp(expect, actual)));
+                CHECK(Same_Strings(opts_ctx_select(ctx, name, tag),
+                                   opts_session_select(session, name, tag)));
+            }
+            expect_args = opts_ctx_arguments(ctx);
+            actual_args = opts_session_arguments(session);
+            CHECK(Same_Strings(expect_args, actual_args));
+            free(expect_args);
+            free(actual_args);
+        }
+        opts_ctx_free(ctx);
+        opts_session_free(session);
+    }
+
+    TEST(Verify_Interned_values_are_shared_between_contexts)
+    {
+        char value1[] = "queue1", value2[] = "queue1";
+        char* args1[] = { "prog", "--bar", value1, "-a" };
+        char* args2[] = { "prog", "-a", "--bar=queue1" };
+        opts_intern_t* table = opts_intern_new(0);
+        opts_ctx_t* ctx1 = opts_ctx_new();
+        opts_ctx_t* ctx2 = opts_ctx_new();
+        const char* interned;
+        opts_ctx_use_intern(ctx1, table);
+        opts_ctx_use_intern(ctx2, table);
+        CHECK(opts_ctx_parse( ctx1, Options_Config, NULL, 4, args1 ));
+        CHECK(opts_ctx_parse( ctx2, Options_Config, NULL, 3, args2 ));
+        interned = opts_ctx_get_value(ctx1, "bar", NULL);
+        CHECK(0 == strcmp("queue1", interned));
+        CHECK((interned != value1) && (interned == opts_ctx_get_value(ctx2, "bar", NULL)));
+        CHECK(interned == opts_intern(table, value2));
+        CHECK(opts_ctx_equal(ctx2, "bar", NULL, interned));
+        CHECK(opts_ctx_equal(ctx2, "bar", NULL, value2));
+        CHECK(0 == strcmp("a", opts_ctx_get_value(ctx1, "a", NULL)));
+        /* The value outlives the command line and the context */
+        value1[0] = 'x';
+        opts_ctx_free(ctx1);
+        CHECK(0 == strcmp("queue1", interned));
+        opts_ctx_use_intern(ctx2, NULL);
+        CHECK(opts_ctx_parse( ctx2, Options_Config, NULL, 4, args1 ));
+        CHECK(opts_ctx_get_value(ctx2, "bar", NULL) == value1);
+        opts_ctx_free(ctx2);
+        opts_intern_free(table);
+    }
+
+    TEST(Verify_Intern_gives_every_thread_the_same_copy)
+    {
+        opts_intern_t* table = opts_intern_new(2);
+        intern_job_t jobs[4];
+        pthread_t threads[4];
+        size_t i, j;
+        for (i = 0; i < 4; i++) {
+            jobs[i].table = table;
+            pthread_create(&threads[i], NULL, Intern_Thread, &jobs[i]);
+        }
+        for (i = 0; i < 4; i++)
+            pthread_join(threads[i], NULL);
+        for (j = 0; j < 5; j++) {
+            CHECK((NULL != jobs[0].interned[j]) && (0 == strcmp(Intern_Values[j], jobs[0].interned[j])));
+            for (i = 1; i < 4; i++)
+                CHECK(jobs[i].interned[j] == jobs[0].interned[j]);
+        }
+        opts_intern_free(table);
+    }
+
+    TEST(Verify_Overlay_overrides_options_of_its_base)
+    {
+        char* base_args[] = { "prog", "-a", "--bar=base", "-b", "1", "-b2", "in.c", "--foo" };
+        char* over_args[] = { "", "--bar=req", "-b", "9", "-c" };
+        opts_ctx_t* base = opts_ctx_new();
+        opts_ctx_t* over;
+        const char** items;
+        CHECK(opts_ctx_parse( base, Options_Config, NULL, 8, base_args ));
+        over = opts_overlay(base);
+        CHECK(NULL != over);
+        CHECK(0 == strcmp("base", opts_ctx_get_value(over, "bar", NULL)));
+        CHECK(opts_ctx_parse( over, Options_Config, NULL, 5, over_args ));
+        CHECK(0 == strcmp("req", opts_ctx_get_value(over, "bar", NULL)));
+        CHECK(0 == strcmp("base", opts_ctx_get_value(base, "bar", NULL)));
+        CHECK(opts_ctx_is_set(over, "foo", NULL) && opts_ctx_is_set(over, "c", NULL));
+        CHECK(!opts_ctx_is_set(base, "c", NULL));
+        items = opts_ctx_select(over, "b", NULL);
+        CHECK((0 == strcmp("9", items[0])) && (NULL == items[1]));
+        items = opts_ctx_select(over, NULL, NULL);
+        CHECK((0 == strcmp("c", items[0])) && (0 == strcmp("9", items[1])) && (0 == strcmp("req", items[2])));
+        CHECK((0 == strcmp("foo", items[3])) && (0 == strcmp("a", items[4])) && (NULL == items[5]));
+        items = opts_ctx_arguments(over);
+        CHECK((0 == strcmp("in.c", items[0])) && (NULL == items[1]));
+        free(items);
+        CHECK(0 == strcmp("prog", opts_ctx_prog_name(over)));
+        CHECK(OPTS_FLAG_SET(opts_ctx_flags(over), opts_ctx_flag_bit(over, "a")));
+        CHECK(OPTS_FLAG_SET(opts_ctx_flags(over), opts_ctx_flag_bit(over, "c")));
+        CHECK(NULL == opts_overlay(over));
+        Error_Log[0] = '\0';
+        CHECK(!opts_ctx_parse( over, Constrained_Config, Logging_Error_Cb, 5, over_args ));
+        CHECK(0 == strcmp(":O;", Error_Log));
+        CHECK(0 == strcmp("req", opts_ctx_get_value(over, "bar", NULL)));
+        opts_ctx_free(over);
+        CHECK(0 == strcmp("2", opts_ctx_select(base, "b", NULL)[0]));
+        opts_ctx_free(base);
+    }
+
+    TEST(Verify_Overlay_rules_see_the_options_of_the_base)
+    {
+        char* base_args[] = { "prog", "--cert", "a.pem", "--fast" };
+        char* over_args[] = { "prog", "--tls" };
+        opts_ctx_t* base = opts_ctx_new();
+        opts_ctx_t* over;
+        CHECK(opts_ctx_parse( base, Rules_Config, NULL, 4, base_args ));
+        over = opts_overlay(base);
+        Error_Log[0] = '\0';
+        CHECK(opts_ctx_parse( over, Rules_Config, Logging_Error_Cb, 2, over_args ));
+        CHECK(0 == strcmp("", Error_Log));
+        opts_ctx_free(over);
+        opts_ctx_free(base);
+    }
+
+    {
+        char* args[] = { "prog", "-a", "--bar=out.txt", "-b", "1", "in1.c", "--foo", "-b2", "in2.c", "--baz", "-c" };
+        opts_ctx_t* ctx = opts_ctx_new();
+        BENCH(Parse_a_typical_command_line_into_a_reused_context)
+        {
+            CHECK(opts_ctx_parse( ctx, Options_Config, NULL, 11, args ));
+        }
+
+        BENCH(Query_a_parsed_result)
+        {
+            CHECK(opts_ctx_is_set(ctx, "c", NULL) && opts_ctx_equal(ctx, "bar", NULL, "out.txt"));
+        }
+        opts_ctx_free(ctx);
+    }
 }
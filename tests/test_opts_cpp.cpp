@@ -0,0 +1,195 @@
+// Unit Test Framework Includes
+#include "atf.h"
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// File To Test
+#include "opts.hpp"
+
+//-----------------------------------------------------------------------------
+// Sample Option Configuration
+//-----------------------------------------------------------------------------
+static opts_cfg_t Cpp_Options_Config[] = {
+    { (char*)"a",   false, (char*)"test_a", (char*)"A simple test option" },
+    { (char*)"b",   true,  (char*)"test_b", (char*)"A simple test option" },
+    { (char*)"foo", false, (char*)"opttag", (char*)"A simple test option" },
+    { (char*)"bar", true,  (char*)"test_e", (char*)"A simple test option" },
+    { (char*)"baz", false, (char*)"opttag", (char*)"A simple test option" },
+    { nullptr,      false, nullptr,         nullptr }
+};
+
+static constexpr opts::option Static_Options[] = {
+    { "a",       false, "test_a", "A simple test option" },
+    { "threads", true,  "perf",   "A simple test option" },
+    { "mode",    true,  "perf",   "A simple test option" },
+};
+
+static constexpr opts::option Static_Alias_Options[] = {
+    { "j",       true,  "perf",   "A simple test option" },
+    { "verbose", false, "log",    "A simple test option" },
+    { .name = "jobs", .alias = "j" },
+    { .name = "v",    .alias = "verbose" },
+    { "q",       false, "log",    "A simple test option" },
+};
+
+static const opts_rule_t Static_Tls_Rules[] = { { OPTS_REQUIRES, "cert", nullptr }, {} };
+
+static constexpr opts::option Static_Rule_Options[] = {
+    { .name = "tls",  .has_arg = false, .tag = "net", .desc = "Use TLS", .rules = Static_Tls_Rules },
+    { .name = "cert", .has_arg = true,  .tag = "net", .desc = "Certificate file" },
+};
+
+static std::vector<std::string> Static_Errors;
+
+static void Static_Error_Cb(const char* msg, char* opt_name) {
+    Static_Errors.push_back(std::string(opt_name) + ": " + msg);
+}
+
+//-----------------------------------------------------------------------------
+// Begin Unit Tests
+//-----------------------------------------------------------------------------
+extern "C" TEST_SUITE(OptsCpp) {
+    TEST(Verify_Result_returns_values_as_views_into_argv)
+    {
+        char* args[] = { (char*)"prog", (char*)"--bar=baz", (char*)"-a" };
+        opts::parser parser(Cpp_Options_Config);
+        opts::result res = parser.parse(3, args);
+        CHECK(res);
+        CHECK(res.is_set("a"));
+        CHECK(!res.is_set("foo"));
+        CHECK(res.value("bar") == "baz");
+        CHECK(res.value("bar").data() == args[1] + 6);
+        CHECK(res.value("foo").data() == nullptr);
+        CHECK(res.equal("bar", nullptr, "baz"));
+        CHECK(res.prog_name() == "prog");
+    }
+
+    TEST(Verify_Results_are_independent_of_each_other)
+    {
+        char* args1[] = { (char*)"prog", (char*)"-a" };
+        char* args2[] = { (char*)"prog", (char*)"--foo" };
+        opts::parser parser(Cpp_Options_Config);
+        opts::result res1 = parser.parse(2, args1);
+        opts::result res2 = parser.parse(2, args2);
+        CHECK(res1.is_set("a") && !res1.is_set("foo"));
+        CHECK(res2.is_set("foo") && !res2.is_set("a"));
+        CHECK(!opts_is_set(nullptr, nullptr));
+    }
+
+    TEST(Verify_Result_can_be_moved)
+    {
+        char* args[] = { (char*)"prog", (char*)"-a" };
+        opts::parser parser(Cpp_Options_Config);
+        opts::result res = parser.parse(2, args);
+        opts::result moved = std::move(res);
+        CHECK(moved.is_set("a"));
+    }
+
+    TEST(Verify_Select_returns_a_span_of_values)
+    {
+        char* args[] = { (char*)"prog", (char*)"--foo", (char*)"-a", (char*)"--baz" };
+        opts::parser parser(Cpp_Options_Config);
+        opts::result res = parser.parse(4, args);
+        std::span<const char* const> values = res.select(nullptr, "opttag");
+        CHECK(2 == values.size());
+        CHECK(0 == strcmp("baz", values[0]));
+        CHECK(0 == strcmp("foo", values[1]));
+        CHECK(res.arguments().empty());
+    }
+
+    TEST(Verify_Entries_visits_options_and_arguments_in_order)
+    {
+        char* args[] = { (char*)"prog", (char*)"x.o", (char*)"-b", (char*)"m", (char*)"y.o", (char*)"-a" };
+        std::vector<std::string_view> seen;
+        opts::parser parser(Cpp_Options_Config);
+        opts::result res = parser.parse(6, args);
+        for (const opts::entry& e : res.entries("b", nullptr, true))
+            seen.push_back(e.value);
+        CHECK(3 == seen.size());
+        CHECK(seen[0] == "x.o");
+        CHECK(seen[1] == "m");
+        CHECK(seen[2] == "y.o");
+    }
+
+    TEST(Verify_Stream_calls_the_callables_in_order)
+    {
+        char* args[] = { (char*)"prog", (char*)"x.o", (char*)"--bar", (char*)"m", (char*)"-a" };
+        std::vector<std::string_view> seen;
+        opts::parser parser(Cpp_Options_Config);
+        parser.stream(5, args,
+            [&](const opts::entry& e) { seen.push_back(e.option->name); seen.push_back(e.value); },
+            [&](const opts::entry& e) { seen.push_back(e.value); });
+        CHECK(5 == seen.size());
+        CHECK(seen[0] == "x.o");
+        CHECK(seen[1] == "bar");
+        CHECK(seen[2] == "m");
+        CHECK(seen[3] == "a");
+        CHECK(seen[4] == "a");
+    }
+
+    TEST(Verify_StaticParser_resolves_options_to_fixed_slots)
+    {
+        char* args[] = { (char*)"prog", (char*)"--threads=4", (char*)"x", (char*)"-a", (char*)"--threads", (char*)"8" };
+        std::vector<std::string_view> seen;
+        auto res = opts::static_parser<Static_Options>().parse(6, args,
+            [&](const opts::entry& e) { seen.push_back(e.value); });
+        CHECK(res);
+        CHECK(res.is_set<"a">());
+        CHECK(!res.is_set<"mode">());
+        CHECK(2 == res.count<"threads">());
+        CHECK(res.get<"threads">() == "8");
+        CHECK(res.get<"mode">().data() == nullptr);
+        CHECK(1 == seen.size() && seen[0] == "x");
+        static_assert(1 == opts::index_of<Static_Options>("threads"));
+    }
+
+    TEST(Verify_StaticParser_results_do_not_carry_over_between_parses)
+    {
+        char* args1[] = { (char*)"prog", (char*)"-a", (char*)"--threads=4" };
+        char* args2[] = { (char*)"prog", (char*)"--mode=x" };
+        auto res1 = opts::static_parser<Static_Options>().parse(3, args1);
+        auto res2 = opts::static_parser<Static_Options>().parse(2, args2);
+        CHECK(res1.is_set<"a">() && res1.get<"threads">() == "4");
+        CHECK(!res2.is_set<"a">() && !res2.is_set<"threads">());
+        CHECK(res2.get<"mode">() == "x");
+    }
+
+    TEST(Verify_StaticParser_resolves_aliases_to_the_option_they_name)
+    {
+        char* args[] = { (char*)"prog", (char*)"--jobs=4", (char*)"-v", (char*)"-q" };
+        auto res = opts::static_parser<Static_Alias_Options>().parse(4, args);
+        CHECK(res);
+        CHECK(res.get<"j">() == "4");
+        CHECK(res.get<"jobs">() == "4");
+        CHECK(res.is_set<"verbose">() && res.is_set<"v">());
+        static_assert(0 == opts::index_of<Static_Alias_Options>("jobs"));
+        static_assert(0 == opts::flag_bit<Static_Alias_Options>("v"));
+        static_assert(1 == opts::flag_bit<Static_Alias_Options>("q"));
+        CHECK(3 == res.flags()[0]);
+    }
+
+    TEST(Verify_StaticParser_checks_the_rules_of_its_options)
+    {
+        char* args1[] = { (char*)"prog", (char*)"--tls" };
+        char* args2[] = { (char*)"prog", (char*)"--tls", (char*)"--cert=a.pem" };
+        opts::static_parser<Static_Rule_Options> parser(Static_Error_Cb);
+        Static_Errors.clear();
+        CHECK(!parser.parse(2, args1));
+        CHECK(1 == Static_Errors.size() && Static_Errors[0] == "tls: Requires option 'cert'");
+        Static_Errors.clear();
+        CHECK(parser.parse(3, args2));
+        CHECK(Static_Errors.empty());
+    }
+
+    TEST(Verify_StaticParser_sets_flag_bits_for_options_without_arguments)
+    {
+        char* args[] = { (char*)"prog", (char*)"-a", (char*)"--threads=4" };
+        constexpr std::size_t bit = opts::flag_bit<Static_Options>("a");
+        auto res = opts::static_parser<Static_Options>().parse(3, args);
+        static_assert(0 == bit);
+        CHECK(OPTS_FLAG_SET(res.flags().data(), bit));
+        CHECK(1 == res.flags()[0]);
+    }
+}
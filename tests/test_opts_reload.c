@@ -0,0 +1,162 @@
+// Unit Test Framework Includes
+#include "atf.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// File To Test
+#include "opts_reload.h"
+
+//-----------------------------------------------------------------------------
+// Sample Option Configuration
+//-----------------------------------------------------------------------------
+static opts_cfg_t Reload_Config[] = {
+    { "threads", true,  "perf", "A simple test option" },
+    { "v",       false, "log",  "A simple test option" },
+    { NULL,      false, NULL,   NULL }
+};
+
+//-----------------------------------------------------------------------------
+// Helper Functions
+//-----------------------------------------------------------------------------
+static char Config_Path[] = "reload_test.conf";
+
+/* Replaces the file atomically so the watcher never sees it half written */
+static void write_config(const char* text) {
+    FILE* file = fopen("reload_test.tmp", "w");
+    fputs(text, file);
+    fclose(file);
+    rename("reload_test.tmp", Config_Path);
+}
+
+static bool Readers_Done = false;
+
+static void* reader_thread(void* arg) {
+    opts_reload_t* reload = (opts_reload_t*)arg;
+    long bad = 0;
+    while (!__atomic_load_n(&Readers_Done, __ATOMIC_SEQ_CST)) {
+        opts_snapshot_t snap = opts_reload_acquire(reload);
+        const char* value = opts_ctx_get_value(snap.ctx, "threads", NULL);
+        bad += ((NULL == value) || ((0 != strcmp(value, "4")) && (0 != strcmp(value, "8"))));
+        opts_reload_release(reload, snap);
+    }
+    return (void*)bad;
+}
+
+static void Quiet_Error_Cb(const char* msg, char* opt_name) {
+    (void)msg;
+    (void)opt_name;
+}
+
+static char Error_Name[256];
+
+static void Recording_Error_Cb(const char* msg, char* opt_name) {
+    (void)msg;
+    snprintf(Error_Name, sizeof(Error_Name), "%s", opt_name);
+}
+
+//-----------------------------------------------------------------------------
+// Begin Unit Tests
+//-----------------------------------------------------------------------------
+TEST_SUITE(Reload) {
+    TEST(Verify_Reload_parses_the_file_when_started)
+    {
+        write_config("# comment -v\n--threads 4   -v\n");
+        opts_reload_t* reload = opts_reload_start(Reload_Config, Quiet_Error_Cb, Config_Path);
+        opts_snapshot_t snap = opts_reload_acquire(reload);
+        CHECK(NULL != snap.ctx);
+        CHECK(snap.ctx && opts_ctx_equal(snap.ctx, "threads", NULL, "4"));
+        CHECK(snap.ctx && opts_ctx_is_set(snap.ctx, "v", NULL));
+        opts_reload_release(reload, snap);
+        opts_reload_stop(reload);
+        remove(Config_Path);
+    }
+
+    TEST(Verify_Reload_keeps_an_acquired_snapshot_unchanged)
+    {
+        write_config("--threads=4");
+        opts_reload_t* reload = opts_reload_start(Reload_Config, Quiet_Error_Cb, Config_Path);
+        opts_snapshot_t old_snap = opts_reload_acquire(reload);
+        opts_reload_release(reload, old_snap);
+        write_config("--threads=8");
+        CHECK(opts_reload_now(reload));
+        opts_snapshot_t new_snap = opts_reload_acquire(reload);
+        CHECK(opts_ctx_equal(new_snap.ctx, "threads", NULL, "8"));
+        opts_reload_release(reload, new_snap);
+        opts_reload_stop(reload);
+        remove(Config_Path);
+    }
+
+    TEST(Verify_Reload_keeps_the_old_snapshot_when_the_file_is_invalid)
+    {
+        write_config("--threads=4");
+        opts_reload_t* reload = opts_reload_start(Reload_Config, Quiet_Error_Cb, Config_Path);
+        write_config("--threads=8 --bogus");
+        CHECK(!opts_reload_now(reload));
+        opts_snapshot_t snap = opts_reload_acquire(reload);
+        CHECK(opts_ctx_equal(snap.ctx, "threads", NULL, "4"));
+        opts_reload_release(reload, snap);
+        opts_reload_stop(reload);
+        remove(Config_Path);
+    }
+
+    TEST(Verify_Reload_reports_a_file_that_cannot_be_opened)
+    {
+        char path[] = "reload_missing.conf";
+        Error_Name[0] = '\0';
+        opts_reload_t* reload = opts_reload_start(Reload_Config, Recording_Error_Cb, path);
+        CHECK(0 == strcmp(path, Error_Name));
+        Error_Name[0] = '\0';
+        CHECK(!opts_reload_now(reload));
+        CHECK(0 == strcmp(path, Error_Name));
+        opts_snapshot_t snap = opts_reload_acquire(reload);
+        CHECK(NULL == snap.ctx);
+        opts_reload_release(reload, snap);
+        opts_reload_stop(reload);
+    }
+
+    TEST(Verify_Reload_readers_always_see_a_complete_snapshot)
+    {
+        pthread_t readers[2];
+        void* bad[2];
+        int i;
+        write_config("--threads=4");
+        opts_reload_t* reload = opts_reload_start(Reload_Config, Quiet_Error_Cb, Config_Path);
+        Readers_Done = false;
+        for (i = 0; i < 2; i++)
+            pthread_create(&readers[i], NULL, reader_thread, reload);
+        for (i = 0; i < 50; i++) {
+            write_config((i % 2) ? "--threads=4" : "--threads=8");
+            (void)opts_reload_now(reload);
+        }
+        __atomic_store_n(&Readers_Done, true, __ATOMIC_SEQ_CST);
+        for (i = 0; i < 2; i++)
+            pthread_join(readers[i], &bad[i]);
+        CHECK(NULL == bad[0]);
+        CHECK(NULL == bad[1]);
+        opts_reload_stop(reload);
+        remove(Config_Path);
+    }
+
+#ifdef __linux__
+    TEST(Verify_Reload_picks_up_changes_to_the_file)
+    {
+        struct timespec delay = { 0, 10000000 };
+        int tries;
+        bool changed = false;
+        write_config("--threads=4");
+        opts_reload_t* reload = opts_reload_start(Reload_Config, Quiet_Error_Cb, Config_Path);
+        write_config("--threads=16");
+        for (tries = 0; !changed && (tries < 200); tries++) {
+            opts_snapshot_t snap = opts_reload_acquire(reload);
+            changed = opts_ctx_equal(snap.ctx, "threads", NULL, "16");
+            opts_reload_release(reload, snap);
+            nanosleep(&delay, NULL);
+        }
+        CHECK(changed);
+        opts_reload_stop(reload);
+        remove(Config_Path);
+    }
+#endif
+}